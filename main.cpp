@@ -1,51 +1,219 @@
+#ifdef _WIN32
 #include <windows.h>
+#endif
 #include <GL/glut.h>
+#include <GL/freeglut_ext.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_mixer.h>
 #include <cmath>
 #include <ctime>
 #include <vector>
+#include <string>
 #include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WEATHER_SIMD 1
+#include <immintrin.h>
+#else
+#define WEATHER_SIMD 0
+#endif
+
+// Headless rendering draws into an EGL pbuffer, which Mesa provides without a
+// display server or GPU (llvmpipe). It is off by default; build with
+// -DHEADLESS_EGL=1 (the Linux target does) and link with -lEGL.
+#ifndef HEADLESS_EGL
+#define HEADLESS_EGL 0
+#endif
+#if HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// The asset pack is memory-mapped: MapViewOfFile on Windows, mmap elsewhere.
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#endif
 
 using namespace std;
 
+// --- GL Call Counters ---
+// In a profiling build (-DPROFILE_GL_CALLS=1, the Debug and Linux targets) the
+// GL calls the draw functions use are routed through these wrappers so the
+// profiler can report vertices, draw calls and state changes per scope. Other
+// builds call GL directly and report those columns as n/a. Counts are per
+// thread; vertices compiled into a display list are counted when the list is
+// built, and each glCallList counts as one draw call.
+
+#ifndef PROFILE_GL_CALLS
+#define PROFILE_GL_CALLS 0
+#endif
+
+struct GLCallCounts {
+    long long vertices, drawCalls, stateChanges;
+};
+thread_local GLCallCounts glCalls = {0, 0, 0};
+
+#if PROFILE_GL_CALLS
+inline void countedVertex2f(GLfloat x, GLfloat y) { glCalls.vertices++; glVertex2f(x, y); }
+inline void countedVertex3f(GLfloat x, GLfloat y, GLfloat z) { glCalls.vertices++; glVertex3f(x, y, z); }
+inline void countedRectf(GLfloat x1, GLfloat y1, GLfloat x2, GLfloat y2) { glCalls.vertices += 4; glCalls.drawCalls++; glRectf(x1, y1, x2, y2); }
+inline void countedBegin(GLenum mode) { glCalls.drawCalls++; glBegin(mode); }
+inline void countedDrawArrays(GLenum mode, GLint first, GLsizei count) { glCalls.vertices += count; glCalls.drawCalls++; glDrawArrays(mode, first, count); }
+inline void countedCallList(GLuint list) { glCalls.drawCalls++; glCallList(list); }
+inline void countedEnable(GLenum cap) { glCalls.stateChanges++; glEnable(cap); }
+inline void countedDisable(GLenum cap) { glCalls.stateChanges++; glDisable(cap); }
+inline void countedBlendFunc(GLenum src, GLenum dst) { glCalls.stateChanges++; glBlendFunc(src, dst); }
+inline void countedLineWidth(GLfloat width) { glCalls.stateChanges++; glLineWidth(width); }
+inline void countedPointSize(GLfloat size) { glCalls.stateChanges++; glPointSize(size); }
+inline void countedPushAttrib(GLbitfield mask) { glCalls.stateChanges++; glPushAttrib(mask); }
+inline void countedPopAttrib() { glCalls.stateChanges++; glPopAttrib(); }
+
+#define glVertex2f countedVertex2f
+#define glVertex3f countedVertex3f
+#define glRectf countedRectf
+#define glBegin countedBegin
+#define glDrawArrays countedDrawArrays
+#define glCallList countedCallList
+#define glEnable countedEnable
+#define glDisable countedDisable
+#define glBlendFunc countedBlendFunc
+#define glLineWidth countedLineWidth
+#define glPointSize countedPointSize
+#define glPushAttrib countedPushAttrib
+#define glPopAttrib countedPopAttrib
+#endif
+
 
 const float PI = 3.1415926535f;
 
 // --- Animation & Environment Variables ---
 float dayNightPhase = 0.1f;
+const float DAY_PHASE_PER_TICK = 0.0002f;
 float crystalGlow = 0.0f;
+const float CRYSTAL_GLOW_PER_TICK = 0.05f;
 float riverFlowOffset = 0.0f;
 enum Weather { SUNNY, RAINY, SNOWY };
 Weather currentWeather = SUNNY;
 enum TimeMoment { MORNING, NOON, EVENING, NIGHT };
-enum ParticleType { SPARK, SMOKE, EMBER };
-const int MAX_PARTICLES = 200;
+enum ParticleType { SPARK, SMOKE, EMBER, PARTICLE_TYPE_COUNT };
+const int MAX_PARTICLES = 32768; // capacity of each particle type's stream
 float snowCoverage = 0.0f;
 float riverFreezeAmount = 0.0f;
 
+// --- Frame Timing ---
+// The simulation advances in fixed SIM_DT steps; rendering runs as often as
+// the display allows and blends actor positions by renderAlpha, the fraction
+// of a step accumulated since the last tick.
+const float SIM_DT = 0.016f;
+const int MAX_SIM_STEPS_PER_FRAME = 5; // more than this and the backlog is dropped
+double simAccumulator = 0.0;
+float renderAlpha = 1.0f;
+long long simTick = 0;   // steps since resetScene()
+
+// Blends a previous and current value by renderAlpha. A jump larger than
+// wrapSpan means the actor wrapped around the screen, so it snaps instead.
+float interpolated(float prev, float cur, float wrapSpan) {
+    if (fabsf(cur - prev) > wrapSpan) return cur;
+    return prev + (cur - prev) * renderAlpha;
+}
+
 // --- Audio ---
-Mix_Music *riverSound = NULL;
-Mix_Chunk *thunderSound = NULL;
-Mix_Chunk *birdSound = NULL;
-Mix_Chunk *rainSound = NULL;
-Mix_Music *winterSound = NULL;
+// Every ambient bed is decoded to PCM once by initAudio() and stays resident
+// for the whole run. Each bed owns a reserved mixer channel, so a soundscape
+// change is a set of fades that SDL_mixer runs on its own audio thread.
+enum AudioBed { BED_RIVER, BED_WINTER, BED_THUNDER, BED_BIRDS, AUDIO_BED_COUNT };
+const char* const audioBedFiles[AUDIO_BED_COUNT] = {
+    "river.mp3", "winter.mp3", "thunder.wav", "bird.mp3"
+};
+// Beds that make up each weather's soundscape, indexed by Weather. Rain itself
+// is not a bed; see Procedural Rain Audio.
+const unsigned soundscapeBeds[3] = {
+    (1u << BED_RIVER) | (1u << BED_BIRDS),   // SUNNY
+    (1u << BED_THUNDER),                     // RAINY
+    (1u << BED_WINTER)                       // SNOWY
+};
+const int AUDIO_CROSSFADE_MS = 1500;
 
-int birdChannel = -1;
-int rainChannel = -1;
-int thunderChannel = -1;
+Mix_Chunk* audioBeds[AUDIO_BED_COUNT] = {};
+bool audioReady = false;
+int audioWeather = -1;   // weather whose soundscape is playing, -1 for none
+
+// Filled by the simulation, drained by the audio callback: ground hits since
+// the callback last ran, and the rain loudness (0 when it isn't raining).
+// Hits are only published while the callback is hooked, so nothing piles up
+// when rain audio is off (headless, benchmark, or an unsupported mixer).
+atomic<bool> rainAudioHooked(false);
+atomic<int> rainAudioHits(0);
+atomic<float> rainAudioLevel(0.0f);
 
 // --- Struct Definitions for Scene Elements ---
-struct FallingLeaf {
-    float x, y, size, speed, sway, swaySpeed, rotation, rotationSpeed;
-    float r, g, b;
+
+// Variable-length entity lists (butterflies, fireflies, puddles, splashes,
+// droplets) live in fixed-capacity pools that exist for the whole run. clear()
+// only resets the count, so a weather or time-of-day change that empties a
+// subsystem and refills it later reuses the same storage instead of freeing
+// and reallocating it. push_back() drops the item once the pool is full.
+template <typename T, int N>
+struct FixedPool {
+    int count = 0;
+    T items[N];
+
+    bool empty() const { return count == 0; }
+    int size() const { return count; }
+    void clear() { count = 0; }
+    bool push_back(const T& item) {
+        if (count == N) return false;
+        items[count++] = item;
+        return true;
+    }
+    void pop_back() { --count; }
+    T& back() { return items[count - 1]; }
+    T& operator[](int i) { return items[i]; }
+    const T& operator[](int i) const { return items[i]; }
+    T* begin() { return items; }
+    T* end() { return items + count; }
+    const T* begin() const { return items; }
+    const T* end() const { return items + count; }
+
+    // Copies just the live items, for publishSnapshot().
+    void copyFrom(const FixedPool& other) {
+        count = other.count;
+        memcpy(items, other.items, count * sizeof(T));
+    }
 };
+
+// Leaves, rain and snow are stored as structure-of-arrays so the weather
+// kernels can update several of them per instruction. Each element carries
+// its own xorshift state for respawn positions.
 const int LEAF_COUNT = 80;
-FallingLeaf leaves[LEAF_COUNT];
+struct LeafField {
+    float x[LEAF_COUNT], y[LEAF_COUNT], size[LEAF_COUNT], speed[LEAF_COUNT];
+    float sway[LEAF_COUNT], swaySpeed[LEAF_COUNT], rotation[LEAF_COUNT], rotationSpeed[LEAF_COUNT];
+    float r[LEAF_COUNT], g[LEAF_COUNT], b[LEAF_COUNT];
+    uint32_t seed[LEAF_COUNT];
+};
+LeafField leaves;
 
 enum ElfState { ELF_WALKING, ELF_IDLE };
 struct Elf {
     float x, y, targetX, speed;
+    float prevX;
     float r, g, b;
     ElfState state;
     float stateTimer;
@@ -55,22 +223,33 @@ const int ELF_COUNT = 6;
 Elf elves[ELF_COUNT];
 
 
-struct Particle {
-    ParticleType type;
-    float x, y, vx, vy;
-    float life, maxLife;
-    float size;
-    float r, g, b, a;
+// Campfire particles are kept as structure-of-arrays, one fixed-capacity
+// stream per ParticleType, so updates and draws walk contiguous memory.
+// Positions, velocities and colours are packed per particle so the streams
+// can be handed straight to glVertexPointer/glColorPointer.
+struct ParticleStream {
+    int count;
+    int recycleCursor;   // next slot to overwrite once the stream is full
+    float opacity;       // peak alpha for this particle type
+    float xy[MAX_PARTICLES * 2];
+    float vxy[MAX_PARTICLES * 2];
+    float life[MAX_PARTICLES];
+    float maxLife[MAX_PARTICLES];
+    float size[MAX_PARTICLES];
+    float originY[MAX_PARTICLES]; // height of the emitting fire
+    float rgba[MAX_PARTICLES * 4];
 };
-vector<Particle> particles;
+ParticleStream particleStreams[PARTICLE_TYPE_COUNT];
 
+const int MAX_BUTTERFLIES = 7;
 struct Butterfly {
     float x, y, initialY;
+    float prevX, prevY;
     float speed, directionAngle;
     float flutterPhase, bobPhase;
     float r, g, b;
 };
-vector<Butterfly> butterflies;
+FixedPool<Butterfly, MAX_BUTTERFLIES> butterflies;
 
 
 enum PuddleState {
@@ -89,9 +268,29 @@ struct Puddle {
     PuddleState state;
     float freezeProgress;
 };
-vector<Puddle> puddles;
-
-
+const int MAX_PUDDLES = 512;
+FixedPool<Puddle, MAX_PUDDLES> puddles;
+
+// Puddles are indexed by a uniform grid over the ground, so placement and
+// rain-hit lookups only visit the puddles in the 3x3 cells around a point.
+// Cells are as wide as two of the largest puddles and squashed by the same
+// PUDDLE_Y_SCALE the puddles are drawn with, so two puddles that can touch
+// always sit in the same or adjacent cells. Each cell is a linked list
+// through puddleNext; updatePuddles() rebuilds it after removing puddles.
+const float PUDDLE_MIN_RADIUS = 0.03f;
+const float PUDDLE_MAX_RADIUS = 0.12f;
+const float PUDDLE_Y_SCALE = 0.4f;
+const float PUDDLE_GRID_X0 = -2.5f;
+const float PUDDLE_GRID_Y0 = -0.9f;
+const float PUDDLE_CELL_WIDTH = 2.0f * PUDDLE_MAX_RADIUS;
+const float PUDDLE_CELL_HEIGHT = PUDDLE_CELL_WIDTH * PUDDLE_Y_SCALE;
+const int PUDDLE_GRID_COLS = 21;  // x in [-2.5, 2.54)
+const int PUDDLE_GRID_ROWS = 10;  // y in [-0.9, 0.06)
+int puddleCellHead[PUDDLE_GRID_COLS * PUDDLE_GRID_ROWS];
+int puddleNext[MAX_PUDDLES];
+
+
+const int MAX_FIREFLIES = 50;
 struct Firefly {
     float x, y, z;
     float initialY;
@@ -99,13 +298,13 @@ struct Firefly {
     float glowPhase;
     float movePhaseX, movePhaseY;
 };
-vector<Firefly> fireflies;
+FixedPool<Firefly, MAX_FIREFLIES> fireflies;
 
 
 struct Campfire {
     float x, y;
-    float flamePhase1;
-    float flamePhase2;
+    float flamePhase1 = 0.0f;
+    float flamePhase2 = 0.0f;
 };
 vector<Campfire> campfires;
 
@@ -121,25 +320,43 @@ struct SmokePuff {
 };
 vector<SmokePuff> smokePuffs;
 
-struct Raindrop {
-    float x, y, speed;
-};
 const int RAIN_COUNT = 300;
-Raindrop raindrops[RAIN_COUNT];
+const int MAX_RAIN = RAIN_COUNT * 100; // "monsoon" preset
+int rainCount = RAIN_COUNT;
+struct RainField {
+    float x[MAX_RAIN], y[MAX_RAIN], speed[MAX_RAIN];
+    uint32_t seed[MAX_RAIN];
+};
+RainField raindrops;
+
+// Where raindrops hit the ground this tick, filled by the rain kernel
+float rainHitX[MAX_RAIN];
+float rainHitY[MAX_RAIN];
+
+// The x of every hit this tick, packed, for updatePuddles() to land on the ground
+float rainLandingX[MAX_RAIN];
+int rainLandingCount = 0;
+
+// Splash and droplet pools are sized for the monsoon preset (which peaks
+// around 7.7k rings and 68k droplets). Spawning takes the slot after the last
+// live entry and each tick compacts the survivors to the front in one pass,
+// so slots freed by expired entries are reused without a free list.
+const int MAX_SPLASHES = 16384;
+const int MAX_DROPLETS = MAX_SPLASHES * 8;
 
 struct Splash {
     float x, y, radius, maxRadius, life;
 };
-vector<Splash> splashes;
+FixedPool<Splash, MAX_SPLASHES> splashes;
 
 
 struct Droplet {
     float x, y, vx, vy, life;
 };
-vector<Droplet> droplets;
+FixedPool<Droplet, MAX_DROPLETS> droplets;
 
 struct Star {
-    float x, y, radius, alpha, twinkleSpeed, initialPhase;
+    float x, y, radius, twinkleSpeed, initialPhase;
 };
 const int STAR_COUNT = 150;
 Star stars[STAR_COUNT];
@@ -150,42 +367,461 @@ struct CloudCircle {
 };
 
 struct Cloud {
-    float x, y, speed;
+    float x, y, speed;   // x at tick 0
     int num_circles;
     CloudCircle circles[20];
 };
 const int CLOUD_COUNT = 7;
 Cloud clouds[CLOUD_COUNT];
 
+// A bird flies straight right from startX at startTick, so its position and
+// wing phase at any later tick follow from these; updateBirds() only handles
+// the wrap back to the left edge, which picks a new height and speed.
 struct Bird {
-    float x, y;
+    float startX, y;
+    long long startTick;
     float speed;
-    float phase;
+    float startPhase;
 };
 const int MAX_BIRDS = 7;
 Bird birds[MAX_BIRDS];
 
+// The fox walks its path whenever it is not raining; pausedTicks counts the
+// rainy steps so its walk can be evaluated from the clock.
 struct FairyFox {
-    float progress;
     float speed;
-    float tailSway;
+    long long pausedTicks;
 };
 FairyFox fox;
 
-struct Snowflake {
-    float x, y, size, speed, swayPhase;
-};
 const int SNOW_COUNT = 1000;
-Snowflake snowflakes[SNOW_COUNT];
+const int MAX_SNOW = SNOW_COUNT * 100; // "blizzard" preset
+int snowCount = SNOW_COUNT;
+struct SnowField {
+    float x[MAX_SNOW], y[MAX_SNOW], size[MAX_SNOW], speed[MAX_SNOW], swayPhase[MAX_SNOW];
+    uint32_t seed[MAX_SNOW];
+};
+SnowField snowflakes;
+
+// --- Render Snapshot ---
+// The draw functions never read the simulation state directly. After each
+// batch of simulation steps publishSnapshot() copies what they need into
+// `view`, so the next steps can run on the job system while the GLUT thread
+// draws this copy. Only the live part of the large fields is copied.
+struct ParticleView {
+    int count;
+    float xy[MAX_PARTICLES * 2];
+    float size[MAX_PARTICLES];
+    float rgba[MAX_PARTICLES * 4];
+};
+
+struct SceneSnapshot {
+    long long simTick;
+    float dayNightPhase, crystalGlow, riverFlowOffset;
+    float snowCoverage, riverFreezeAmount;
+    vector<Campfire> campfires;
+    FairyFox fox;
+    Elf elves[ELF_COUNT];
+    Star stars[STAR_COUNT];
+    Cloud clouds[CLOUD_COUNT];
+    Bird birds[MAX_BIRDS];
+    FixedPool<Butterfly, MAX_BUTTERFLIES> butterflies;
+    FixedPool<Firefly, MAX_FIREFLIES> fireflies;
+    FixedPool<Puddle, MAX_PUDDLES> puddles;
+    FixedPool<Splash, MAX_SPLASHES> splashes;
+    FixedPool<Droplet, MAX_DROPLETS> droplets;
+    LeafField leaves;
+    int rainCount;
+    float rainX[MAX_RAIN], rainY[MAX_RAIN];
+    int snowCount;
+    float snowX[MAX_SNOW], snowY[MAX_SNOW], snowSize[MAX_SNOW];
+    ParticleView particles[PARTICLE_TYPE_COUNT];
+};
+SceneSnapshot view;
+
+// --- Clock-Driven Animation ---
+// Stars, clouds, birds and the fox are periodic, so instead of being stepped
+// every tick they are evaluated from the clock when drawn. renderTick() is the
+// (fractional) tick being drawn: the published step blended by renderAlpha
+// the same way interpolated() blends positions.
+double renderTick() {
+    double tick = view.simTick - 1.0 + renderAlpha;
+    return tick > 0.0 ? tick : 0.0;
+}
+
+float starAlphaAt(const Star& star, double tick) {
+    return 0.5f + 0.5f * (float)sin(star.initialPhase + CRYSTAL_GLOW_PER_TICK * tick * star.twinkleSpeed);
+}
+
+// Clouds drift right and jump back to x = -4 once they pass x = 4.
+float cloudXAt(const Cloud& cloud, double tick) {
+    double x = cloud.x + cloud.speed * tick;
+    if (x > 4.0) x = -4.0 + fmod(x - 4.0, 8.0);
+    return (float)x;
+}
+
+float birdXAt(const Bird& bird, double tick) {
+    return bird.startX + bird.speed * (float)max(0.0, tick - bird.startTick);
+}
+
+float birdPhaseAt(const Bird& bird, double tick) {
+    return bird.startPhase + (0.2f + bird.speed * 10.0f) * (float)max(0.0, tick - bird.startTick);
+}
+
+// First tick at which the bird is past the right edge (x > 3).
+long long birdWrapTick(const Bird& bird) {
+    return bird.startTick + (long long)((3.0f - bird.startX) / bird.speed) + 1;
+}
+
+double foxWalkTicks(const FairyFox& fox, double tick) {
+    return max(0.0, tick - fox.pausedTicks);
+}
+
+float foxProgressAt(const FairyFox& fox, double tick) {
+    double distance = fox.speed * SIM_DT * foxWalkTicks(fox, tick);
+    return (float)(distance - floor(distance));
+}
+
+float foxTailSwayAt(const FairyFox& fox, double tick) {
+    return (float)(0.08 * foxWalkTicks(fox, tick));
+}
+
+enum WeatherKernelPath { KERNEL_SCALAR, KERNEL_SSE2, KERNEL_AVX2 };
+WeatherKernelPath weatherKernelPath = KERNEL_SCALAR;
+
+// --- Lighting ---
+// Scene colours are tinted for time of day and weather by one affine map per
+// channel (out = base * scale + offset). The maps for every weather and
+// LIGHTING_LUT_SIZE points of the day are built once at startup, easing
+// between the morning, noon, evening and night tints instead of jumping;
+// each frame picks its entry once and setSceneElementColor() only applies it.
+struct SceneTint {
+    float scale[3], offset[3];
+};
+const int LIGHTING_LUT_SIZE = 512;
+const float TINT_BLEND = 0.015f; // half-width, in day phase, of each time-of-day transition
+SceneTint lightingLut[3][LIGHTING_LUT_SIZE];
+SceneTint sceneTint = {{1.0f, 1.0f, 1.0f}, {0.0f, 0.0f, 0.0f}}; // tint of the frame being drawn
+
+// --- Static Geometry Cache ---
+// Scenery that never moves is compiled into display lists, one per layer.
+// The lists only depend on the weather, the time of day and the scene tint,
+// so they are rebuilt when one of those changes and replayed every other frame.
+enum StaticLayer {
+    LAYER_GROUND,           // hills, ground patches, fox path and bushes
+    LAYER_MUSHROOMS,
+    LAYER_FIELDS_AND_TREES, // vegetable fields, trees and archery ground
+    LAYER_VILLAGE_PROPS,    // wishing well, front trees, lanterns and fence
+    LAYER_GREAT_TREE,       // trunk, foliage and branches
+    LAYER_TREE_HOUSES,      // tree houses and the snow on the great tree
+    LAYER_HOUSES,
+    STATIC_LAYER_COUNT
+};
+GLuint staticLayerLists = 0;
+int cachedWeather = -1;
+int cachedTimeMoment = -1;
+SceneTint cachedTint;
+float cachedPixelsPerUnit = 0.0f;
+
+// --- Scene Layout ---
+// Placed scenery is data rather than code: a flat array of SceneProp records
+// sorted by type, so every type is one contiguous group that is drawn by a
+// single loop. The layout comes from `--scene PATH`, else the asset pack's
+// village.scene entry, else the built-in defaultSceneProps; files are
+// memory-mapped and the records used in place.
+enum PropType {
+    PROP_BUSH,
+    PROP_MUSHROOM,
+    PROP_VEGETABLE_FIELD,  // sx, sy are the field's width and height
+    PROP_FIELD_TREE,
+    PROP_ARCHERY_GROUND,
+    PROP_WISHING_WELL,
+    PROP_FRONT_TREE,
+    PROP_LANTERN,
+    PROP_FENCE,            // param is the number of sections
+    PROP_HOUSE,
+    PROP_FLOWER,           // tint is the petal colour
+    PROP_TYPE_COUNT
+};
+
+// Static layer each prop type is compiled into, in draw order within the
+// layer; -1 for types drawn every frame.
+const int propTypeLayer[PROP_TYPE_COUNT] = {
+    LAYER_GROUND, LAYER_MUSHROOMS,
+    LAYER_FIELDS_AND_TREES, LAYER_FIELDS_AND_TREES, LAYER_FIELDS_AND_TREES,
+    LAYER_VILLAGE_PROPS, LAYER_VILLAGE_PROPS, LAYER_VILLAGE_PROPS, LAYER_VILLAGE_PROPS,
+    LAYER_HOUSES, -1
+};
+
+struct SceneProp {
+    uint16_t type;     // PropType
+    uint16_t param;
+    float x, y;
+    float sx, sy;      // scale; sy only matters for types that stretch
+    float tint[3];     // multiplies the prop's base colours
+};
+
+const SceneProp* sceneProps = nullptr;
+int scenePropCount = 0;
+int propGroupStart[PROP_TYPE_COUNT + 1];  // group t is [start[t], start[t + 1])
+const float NO_PROP_TINT[3] = { 1.0f, 1.0f, 1.0f };
+const float* propTint = NO_PROP_TINT;     // tint of the prop being drawn
+
+// --- Circle Renderer ---
+// drawCircle() reads its rim from a precomputed unit-circle table. Effects
+// that draw many world-space circles (snow, stars, clouds, smoke, puddles,
+// glows) submit them to the render queue with submitCircle() instead.
+const int CIRCLE_SEGMENTS = 30;
+float unitCircleCos[CIRCLE_SEGMENTS + 1];
+float unitCircleSin[CIRCLE_SEGMENTS + 1];
+
+// Circles smaller than this on screen are drawn as smooth points.
+const float POINT_SPRITE_MAX_DIAMETER = 8.0f;
+const int POINT_SPRITE_SIZES = 8;
+float pixelsPerUnit = 384.0f;
+
+// --- Render Queue ---
+// Blended effects are not drawn straight away: draw functions queue
+// world-space commands keyed by (layer, blend mode, primitive, line width or
+// point size) and flushRenderQueue() sorts them by key, then draws each run
+// of equal keys with one glDrawArrays, setting only the state that differs
+// from the previous run. The layer is the ordering constraint: commands never
+// move past a lower layer, and within a layer only commands with the same key
+// keep their submission order. Fans, polygons and quads are triangulated when
+// queued so that runs of any of them merge into one triangle list.
+enum RenderBlend { BLEND_OPAQUE, BLEND_ALPHA, BLEND_ADDITIVE };
+enum RenderPrimitive { PRIM_TRIANGLES, PRIM_LINES, PRIM_POINTS };
+
+struct RenderVertex {
+    float x, y;
+    float r, g, b, a;
+};
+
+struct RenderCommand {
+    uint32_t key;    // layer << 24 | blend << 22 | primitive << 20 | width * 16
+    uint32_t seq;    // submission order, keeps the sort stable
+    int first, count;
+};
+
+// The vectors keep their capacity between flushes, so a warmed-up scene
+// queues without allocating.
+vector<RenderVertex> renderVertices;
+vector<RenderVertex> renderScratch;   // the open command, before triangulation
+vector<RenderCommand> renderCommands;
+GLenum renderScratchMode = GL_TRIANGLES;
+uint32_t renderScratchKey = 0;
+float renderColor[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+// Per frame: commands queued, and the draw calls and blend/width state
+// changes they cost after sorting. The submission-order counts are never
+// drawn; flushRenderQueue() estimates them by replaying the unsorted keys
+// through applyRenderState() without issuing GL calls.
+struct RenderQueueStats {
+    long long commands;
+    long long drawCallsSubmitted, drawCallsIssued;
+    long long stateChangesSubmitted, stateChangesIssued;
+};
+RenderQueueStats renderQueueFrame = {}, renderQueueLast = {}, renderQueueTotal = {};
+
+// --- Frame Arena ---
+// A linear allocator for data that only lives until the next frame is drawn
+// (the render queue's sorted vertex stream). frameAlloc() bumps an offset and
+// resetFrameArena(), called at the start of renderScene(), releases it all at
+// once. A frame that outgrows the block takes the rest from the heap and the
+// block is regrown to that frame's peak at the next reset, so once the scene
+// has warmed up, drawing makes no heap allocations. Only the GLUT thread draws,
+// so the arena is not locked.
+const size_t FRAME_ARENA_INITIAL_BYTES = 1 << 20;
+const size_t FRAME_ARENA_ALIGN = 16;
+
+struct FrameArenaOverflow {
+    FrameArenaOverflow* next;
+};
+
+struct FrameArena {
+    char* base = NULL;
+    size_t capacity = 0;
+    size_t used = 0;
+    size_t frameBytes = 0;   // this frame, including overflow
+    size_t peakBytes = 0;    // largest frame so far
+    FrameArenaOverflow* overflow = NULL;
+};
+FrameArena frameArena;
+
+// --- Shader Effects ---
+// The sky gradient, the river's wave line and the crystal's night glow are
+// animated by small GLSL programs fed the scene state as uniforms, so their
+// per-vertex and per-pixel maths runs on the GPU. Without GL 2.0 shaders, or
+// with --no-shaders, each effect falls back to its fixed-function drawing.
+
+#ifndef GL_FRAGMENT_SHADER
+#define GL_FRAGMENT_SHADER 0x8B30
+#endif
+#ifndef GL_VERTEX_SHADER
+#define GL_VERTEX_SHADER 0x8B31
+#endif
+#ifndef GL_COMPILE_STATUS
+#define GL_COMPILE_STATUS 0x8B81
+#endif
+#ifndef GL_LINK_STATUS
+#define GL_LINK_STATUS 0x8B82
+#endif
+
+typedef GLuint (GLAPIENTRY *CreateShaderProc)(GLenum);
+typedef void (GLAPIENTRY *ShaderSourceProc)(GLuint, GLsizei, const char* const*, const GLint*);
+typedef void (GLAPIENTRY *CompileShaderProc)(GLuint);
+typedef void (GLAPIENTRY *GetShaderivProc)(GLuint, GLenum, GLint*);
+typedef void (GLAPIENTRY *GetInfoLogProc)(GLuint, GLsizei, GLsizei*, char*);
+typedef void (GLAPIENTRY *DeleteShaderProc)(GLuint);
+typedef GLuint (GLAPIENTRY *CreateProgramProc)();
+typedef void (GLAPIENTRY *DeleteProgramProc)(GLuint);
+typedef void (GLAPIENTRY *AttachShaderProc)(GLuint, GLuint);
+typedef void (GLAPIENTRY *LinkProgramProc)(GLuint);
+typedef void (GLAPIENTRY *GetProgramivProc)(GLuint, GLenum, GLint*);
+typedef void (GLAPIENTRY *UseProgramProc)(GLuint);
+typedef GLint (GLAPIENTRY *GetUniformLocationProc)(GLuint, const char*);
+typedef void (GLAPIENTRY *Uniform1fProc)(GLint, GLfloat);
+typedef void (GLAPIENTRY *Uniform2fProc)(GLint, GLfloat, GLfloat);
+typedef void (GLAPIENTRY *Uniform1fvProc)(GLint, GLsizei, const GLfloat*);
+typedef void (GLAPIENTRY *Uniform3fvProc)(GLint, GLsizei, const GLfloat*);
+
+CreateShaderProc createShader = NULL;
+ShaderSourceProc shaderSource = NULL;
+CompileShaderProc compileShader = NULL;
+GetShaderivProc getShaderiv = NULL;
+GetInfoLogProc getShaderInfoLog = NULL;
+DeleteShaderProc deleteShader = NULL;
+CreateProgramProc createProgram = NULL;
+DeleteProgramProc deleteProgram = NULL;
+AttachShaderProc attachShader = NULL;
+LinkProgramProc linkProgram = NULL;
+GetProgramivProc getProgramiv = NULL;
+GetInfoLogProc getProgramInfoLog = NULL;
+UseProgramProc useProgram = NULL;
+GetUniformLocationProc getUniformLocation = NULL;
+Uniform1fProc uniform1f = NULL;
+Uniform2fProc uniform2f = NULL;
+Uniform1fvProc uniform1fv = NULL;
+Uniform3fvProc uniform3fv = NULL;
+
+bool shaderEffectsDisabled = false; // --no-shaders
+
+// Sky gradients (top, then bottom colour) in TimeMoment order, then the
+// overcast sky used whenever it rains.
+const int SKY_GRADIENT_COUNT = 5;
+const float SKY_GRADIENTS[SKY_GRADIENT_COUNT][2][3] = {
+    {{0.6f, 0.7f, 1.0f}, {1.0f, 0.9f, 0.8f}},    // MORNING
+    {{0.1f, 0.6f, 1.0f}, {0.7f, 0.85f, 1.0f}},   // NOON
+    {{0.9f, 0.5f, 0.2f}, {1.0f, 0.8f, 0.4f}},    // EVENING
+    {{0.0f, 0.0f, 0.1f}, {0.1f, 0.1f, 0.35f}},   // NIGHT
+    {{0.3f, 0.35f, 0.4f}, {0.4f, 0.45f, 0.5f}}   // rain
+};
+
+const int RIVER_WAVE_SEGMENTS = 100;
+float riverWaveXY[(RIVER_WAVE_SEGMENTS + 1) * 2]; // wave x positions, y left at 0 for the shader
+
+struct SkyEffect {
+    GLuint program;
+    GLint dayPhase, rain;
+};
+struct RiverEffect {
+    GLuint program;
+    GLint flowOffset, freezeAmount, riverTop;
+};
+struct CrystalEffect {
+    GLuint program;
+    GLint glow, center;
+};
+SkyEffect skyEffect = {0, -1, -1};
+RiverEffect riverEffect = {0, -1, -1, -1};
+CrystalEffect crystalEffect = {0, -1, -1};
+
+// --- Actor Sprites ---
+// Elves, butterflies, birds, leaves and the fox are drawn from a texture atlas
+// holding each of their animation poses, as one textured quad per instance.
+// A pose is baked twice: a base layer with its fixed-colour parts, and a
+// white mask of the parts that take the instance's own colour (tunic, wings,
+// leaf), which is drawn on top modulated by that colour. The base layer bakes
+// in the scene tint, so it is rebaked when the tint changes, the same as the
+// static display lists; both layers are rebaked when the window is resized.
+// Texels are premultiplied by alpha. Poses are drawn straight into the atlas
+// through a framebuffer object when GL_EXT_framebuffer_object is available;
+// otherwise they are drawn in the back buffer and copied, which only works
+// while the window is unobscured.
+enum ActorSprite { SPRITE_ELF, SPRITE_BUTTERFLY, SPRITE_BIRD, SPRITE_LEAF, SPRITE_FOX_BODY, SPRITE_FOX_TAIL, ACTOR_SPRITE_COUNT };
+enum SpriteLayer { SPRITE_LAYER_BASE, SPRITE_LAYER_MASK };
+
+struct ActorSpriteDef {
+    int frames;                 // poses over one animation cycle
+    float x0, y0, x1, y1;       // bounds of a pose in its own units
+    float bakeScale;            // world units per pose unit the atlas is baked at
+    bool hasBase, hasMask;
+    void (*drawPose)(float phase, SpriteLayer layer);
+};
+
+// One baked layer of one pose: its atlas texture rectangle and the matching
+// quad in pose units (the bounds plus a transparent margin).
+struct SpriteCell {
+    float u0, v0, u1, v1;
+    float x0, y0, x1, y1;
+    int px, py, width, height; // atlas pixels
+};
+
+struct SpriteInstance {
+    float x, y, rotation;       // rotation in radians
+    float scaleX, scaleY;       // world units per pose unit; negative mirrors
+    float r, g, b, a;           // mask colour; a also fades the base layer
+};
+
+struct SpriteStream {
+    vector<float> xy, uv, rgba;
+};
+
+const int SPRITE_ATLAS_WIDTH = 1024;
+const int SPRITE_CELL_MARGIN = 2; // transparent pixels around each cell
+const int MAX_SPRITE_CELLS = 256;
+SpriteCell spriteCells[MAX_SPRITE_CELLS];
+int spriteFirstCell[ACTOR_SPRITE_COUNT];
+GLuint spriteAtlasTexture = 0;
+int spriteAtlasHeight = 0;
+float spriteAtlasPixelsPerUnit = 0.0f; // pixelsPerUnit the atlas was baked at
+SceneTint spriteAtlasTint;
+SpriteStream spriteStream;
+
+#ifndef GL_FRAMEBUFFER_EXT
+#define GL_FRAMEBUFFER_EXT 0x8D40
+#endif
+#ifndef GL_COLOR_ATTACHMENT0_EXT
+#define GL_COLOR_ATTACHMENT0_EXT 0x8CE0
+#endif
+#ifndef GL_FRAMEBUFFER_COMPLETE_EXT
+#define GL_FRAMEBUFFER_COMPLETE_EXT 0x8CD5
+#endif
+
+typedef void (GLAPIENTRY *GenFramebuffersProc)(GLsizei, GLuint*);
+typedef void (GLAPIENTRY *BindFramebufferProc)(GLenum, GLuint);
+typedef void (GLAPIENTRY *FramebufferTexture2DProc)(GLenum, GLenum, GLenum, GLuint, GLint);
+typedef GLenum (GLAPIENTRY *CheckFramebufferStatusProc)(GLenum);
+
+GenFramebuffersProc genFramebuffers = NULL;
+BindFramebufferProc bindFramebuffer = NULL;
+FramebufferTexture2DProc framebufferTexture2D = NULL;
+CheckFramebufferStatusProc checkFramebufferStatus = NULL;
+GLuint spriteBakeFramebuffer = 0;   // 0 = bake through the back buffer
 
 
 // --- Forward Declarations ---
 
 void initSceneElements();
 void initAudio();
-void updateScene(int);
+void updateScene();
+void frameLoop();
+void storePreviousPositions();
+void publishSnapshot();
 void updateLeaves();
 void display();
+void renderScene();
+void reshape(int w, int h);
 void cleanup();
 void drawForegroundRiver();
 void drawMoon();
@@ -204,7 +840,8 @@ void drawUpdatedSimpleTree(float x, float y, float scale);
 void drawLeaves();
 void drawElves();
 void drawCampfire();
-void drawFlowersAndBushes();
+void drawFlowers();
+void loadSceneLayout();
 void drawHangingLantern(float x, float y);
 void drawHangingMoss(float x, float y, float scale);
 void drawWishingWell(float x, float y);
@@ -212,178 +849,937 @@ void drawArcheryTrainingGround(float x, float y);
 void drawArcheryTarget(float x, float y, float scale);
 void drawPracticeDummy(float x, float y, float scale);
 void drawArrowQuiver(float x, float y, float scale);
+void initParticles();
 void drawParticles();
 void drawPuddles();
 void updatePuddles(float dt);
+void rebuildPuddleGrid();
 void initSnow();
 void updateSnow();
 void drawSnow();
 void drawSnowCover();
+void drawStaticLayer(StaticLayer layer);
+void drawElfPose(float phase, SpriteLayer layer);
+void drawButterflyPose(float phase, SpriteLayer layer);
+void drawBirdPose(float phase, SpriteLayer layer);
+void drawLeafPose(SpriteLayer layer);
+void drawFoxBodyPose(float phase, SpriteLayer layer);
+void drawFoxTailPose(SpriteLayer layer);
 
 
 
-TimeMoment getTimeMoment() {
-    if (dayNightPhase >= 0.0f && dayNightPhase < 0.12f) return MORNING;
-    if (dayNightPhase >= 0.12f && dayNightPhase < 0.44f) return NOON;
-    if (dayNightPhase >= 0.44f && dayNightPhase < 0.5f) return EVENING;
+TimeMoment timeMomentAt(float phase) {
+    if (phase >= 0.0f && phase < 0.12f) return MORNING;
+    if (phase >= 0.12f && phase < 0.44f) return NOON;
+    if (phase >= 0.44f && phase < 0.5f) return EVENING;
     return NIGHT;
 }
 
+// Time of day of the frame being drawn; the simulation uses timeMomentAt().
+TimeMoment getTimeMoment() {
+    return timeMomentAt(view.dayNightPhase);
+}
+
+// Tints in TimeMoment order, and the day phase at which each one begins.
+const SceneTint TIME_TINTS[4] = {
+    {{0.8f, 0.8f, 0.8f}, {0.2f, 0.15f, 0.1f}},   // MORNING
+    {{1.0f, 1.0f, 1.0f}, {0.0f, 0.0f, 0.0f}},    // NOON
+    {{0.7f, 0.7f, 0.7f}, {0.3f, 0.2f, 0.05f}},   // EVENING
+    {{0.4f, 0.4f, 0.4f}, {0.05f, 0.05f, 0.15f}}  // NIGHT
+};
+const float TIME_TINT_START[4] = {0.0f, 0.12f, 0.44f, 0.5f};
+
+SceneTint mixTint(const SceneTint& a, const SceneTint& b, float t) {
+    SceneTint out;
+    for (int c = 0; c < 3; ++c) {
+        out.scale[c] = a.scale[c] + (b.scale[c] - a.scale[c]) * t;
+        out.offset[c] = a.offset[c] + (b.offset[c] - a.offset[c]) * t;
+    }
+    return out;
+}
+
+// Time-of-day tint at a day phase, smoothstepped across each boundary.
+SceneTint timeTintAt(float phase) {
+    for (int m = 0; m < 4; ++m) {
+        float d = phase - TIME_TINT_START[m];
+        if (d > 0.5f) d -= 1.0f;
+        if (d < -0.5f) d += 1.0f;
+        if (fabsf(d) < TINT_BLEND) {
+            float t = (d + TINT_BLEND) / (2.0f * TINT_BLEND);
+            return mixTint(TIME_TINTS[(m + 3) % 4], TIME_TINTS[m], t * t * (3.0f - 2.0f * t));
+        }
+    }
+    return TIME_TINTS[timeMomentAt(phase)];
+}
+
+void initLightingLut() {
+    const float weatherScale[3][3] = {
+        {1.0f, 1.0f, 1.0f},  // SUNNY
+        {0.6f, 0.6f, 0.7f},  // RAINY darkens the base colour before the time tint
+        {1.0f, 1.0f, 1.0f}   // SNOWY
+    };
+    for (int i = 0; i < LIGHTING_LUT_SIZE; ++i) {
+        SceneTint tint = timeTintAt((float)i / LIGHTING_LUT_SIZE);
+        for (int w = 0; w < 3; ++w) {
+            SceneTint& entry = lightingLut[w][i];
+            for (int c = 0; c < 3; ++c) {
+                entry.scale[c] = tint.scale[c] * weatherScale[w][c];
+                entry.offset[c] = tint.offset[c];
+            }
+        }
+    }
+}
+
+// Picks this frame's tint. Called once at the start of each frame.
+void updateSceneTint() {
+    int i = (int)(view.dayNightPhase * LIGHTING_LUT_SIZE + 0.5f) % LIGHTING_LUT_SIZE;
+    if (i < 0) i = 0;
+    sceneTint = lightingLut[currentWeather][i];
+}
+
+// One colour channel with the current prop's and this frame's tint applied.
+inline float tinted(float base, int channel) {
+    return base * propTint[channel] * sceneTint.scale[channel] + sceneTint.offset[channel];
+}
+
 void setSceneElementColor(float baseR, float baseG, float baseB, float alpha = 1.0f) {
-    TimeMoment tm = getTimeMoment();
-    float r = baseR, g = baseG, b = baseB;
+    glColor4f(tinted(baseR, 0), tinted(baseG, 1), tinted(baseB, 2), alpha);
+}
 
-    if (currentWeather == RAINY) {
-        r *= 0.6f; g *= 0.6f; b *= 0.7f;
+// --- Shader Effects ---
+
+// Per vertex: picks the top or bottom sky colour for the time of day,
+// smoothstepped across each boundary the same way as timeTintAt().
+const char* SKY_VERTEX_SHADER =
+    "#version 110\n"
+    "uniform float dayPhase;\n"
+    "uniform float rain;\n"
+    "uniform float blendWidth;\n"
+    "uniform float momentStart[4];\n"
+    "uniform vec3 topColors[5];\n"
+    "uniform vec3 bottomColors[5];\n"
+    "vec3 gradientColor(int i) {\n"
+    "    return gl_Vertex.y > 0.0 ? topColors[i] : bottomColors[i];\n"
+    "}\n"
+    "void main() {\n"
+    "    int moment = 0;\n"
+    "    for (int i = 1; i < 4; ++i) {\n"
+    "        if (dayPhase >= momentStart[i]) moment = i;\n"
+    "    }\n"
+    "    vec3 color = gradientColor(moment);\n"
+    "    for (int i = 0; i < 4; ++i) {\n"
+    "        float d = dayPhase - momentStart[i];\n"
+    "        if (d > 0.5) d -= 1.0;\n"
+    "        if (d < -0.5) d += 1.0;\n"
+    "        if (abs(d) < blendWidth) {\n"
+    "            int previous = i == 0 ? 3 : i - 1;\n"
+    "            color = mix(gradientColor(previous), gradientColor(i), smoothstep(-blendWidth, blendWidth, d));\n"
+    "        }\n"
+    "    }\n"
+    "    if (rain > 0.5) color = gradientColor(4);\n"
+    "    gl_FrontColor = vec4(color, 1.0);\n"
+    "    gl_Position = ftransform();\n"
+    "}\n";
+
+// Per vertex: lifts a point of the wave line to its height at this flow
+// offset; the waves fade out as the river freezes.
+const char* RIVER_VERTEX_SHADER =
+    "#version 110\n"
+    "uniform float flowOffset;\n"
+    "uniform float freezeAmount;\n"
+    "uniform float riverTop;\n"
+    "void main() {\n"
+    "    float x = gl_Vertex.x;\n"
+    "    float y = riverTop + 0.02 * sin(x * 3.0 + flowOffset * 1.5) + 0.01 * cos(x * 1.5 + flowOffset) + 0.005;\n"
+    "    gl_FrontColor = vec4(0.6, 0.85, 1.0, 0.6 * (1.0 - freezeAmount));\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * vec4(x, y, 0.0, 1.0);\n"
+    "}\n";
+
+const char* VERTEX_COLOR_FRAGMENT_SHADER =
+    "#version 110\n"
+    "void main() {\n"
+    "    gl_FragColor = gl_Color;\n"
+    "}\n";
+
+// The three pulsing aura colours only depend on the glow phase, so they are
+// worked out per vertex (already multiplied by their alpha) and the fragment
+// shader just sums the ellipses each pixel falls inside.
+const char* CRYSTAL_VERTEX_SHADER =
+    "#version 110\n"
+    "uniform float glow;\n"
+    "uniform vec2 center;\n"
+    "varying vec2 offset;\n"
+    "varying vec3 aura;\n"
+    "varying vec3 mid;\n"
+    "varying vec3 core;\n"
+    "void main() {\n"
+    "    const float PI = 3.1415926535;\n"
+    "    aura = vec3(0.4 + 0.1 * sin(glow * 0.5), 0.7 + 0.1 * sin(glow * 0.6 + PI / 2.0), 0.9 + 0.1 * sin(glow * 0.4 + PI))\n"
+    "         * (0.06 * (0.6 + 0.4 * sin(glow * 0.7)));\n"
+    "    mid = vec3(0.5 + 0.2 * sin(glow * 0.8), 0.8 + 0.2 * sin(glow * 0.9 + PI / 3.0), 1.0)\n"
+    "        * (0.12 * (0.7 + 0.3 * sin(glow * 1.2 + PI / 4.0)));\n"
+    "    core = vec3(0.7 + 0.3 * sin(glow * 1.5), 0.9 + 0.1 * sin(glow * 1.6 + PI / 6.0), 1.0)\n"
+    "         * (0.25 * (0.8 + 0.2 * sin(glow * 1.8)));\n"
+    "    offset = gl_Vertex.xy - center;\n"
+    "    gl_Position = ftransform();\n"
+    "}\n";
+
+const char* CRYSTAL_FRAGMENT_SHADER =
+    "#version 110\n"
+    "varying vec2 offset;\n"
+    "varying vec3 aura;\n"
+    "varying vec3 mid;\n"
+    "varying vec3 core;\n"
+    "float inside(float radius, float yScale) {\n"
+    "    vec2 p = vec2(offset.x, offset.y / yScale);\n"
+    "    return step(dot(p, p), radius * radius);\n"
+    "}\n"
+    "void main() {\n"
+    "    gl_FragColor = vec4(aura * inside(0.35, 1.3) + mid * inside(0.22, 1.2) + core * inside(0.15, 1.1), 1.0);\n"
+    "}\n";
+
+// Returns 0 and prints the info log if the stage does not compile.
+GLuint compileShaderStage(GLenum type, const char* source, const char* effect) {
+    GLuint shader = createShader(type);
+    shaderSource(shader, 1, &source, NULL);
+    compileShader(shader);
+    GLint compiled = 0;
+    getShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (!compiled) {
+        char log[1024] = "";
+        getShaderInfoLog(shader, sizeof(log), NULL, log);
+        printf("Shader effects: %s %s shader failed to compile:\n%s\n", effect,
+               type == GL_VERTEX_SHADER ? "vertex" : "fragment", log);
+        deleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+GLuint linkEffect(const char* effect, const char* vertexSource, const char* fragmentSource) {
+    GLuint vertexShader = compileShaderStage(GL_VERTEX_SHADER, vertexSource, effect);
+    GLuint fragmentShader = compileShaderStage(GL_FRAGMENT_SHADER, fragmentSource, effect);
+    if (!vertexShader || !fragmentShader) {
+        if (vertexShader) deleteShader(vertexShader);
+        if (fragmentShader) deleteShader(fragmentShader);
+        return 0;
+    }
+
+    GLuint program = createProgram();
+    attachShader(program, vertexShader);
+    attachShader(program, fragmentShader);
+    linkProgram(program);
+    deleteShader(vertexShader);
+    deleteShader(fragmentShader);
+    GLint linked = 0;
+    getProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        char log[1024] = "";
+        getProgramInfoLog(program, sizeof(log), NULL, log);
+        printf("Shader effects: %s program failed to link:\n%s\n", effect, log);
+        deleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+// Loads the GL 2.0 entry points and builds the effect programs. Any effect
+// whose program is left at 0 keeps drawing through the fixed-function path.
+void initShaderEffects(void* (*getProc)(const char*)) {
+    for (int i = 0; i <= RIVER_WAVE_SEGMENTS; ++i) {
+        riverWaveXY[i * 2] = -2.5f + (i / (float)RIVER_WAVE_SEGMENTS) * 5.0f;
+        riverWaveXY[i * 2 + 1] = 0.0f;
+    }
+
+    const char* version = (const char*)glGetString(GL_VERSION);
+    int major = 0;
+    if (version) sscanf(version, "%d", &major);
+    if (shaderEffectsDisabled || major < 2) {
+        printf("Shader effects: fixed-function\n");
+        return;
+    }
+
+    createShader = (CreateShaderProc)getProc("glCreateShader");
+    shaderSource = (ShaderSourceProc)getProc("glShaderSource");
+    compileShader = (CompileShaderProc)getProc("glCompileShader");
+    getShaderiv = (GetShaderivProc)getProc("glGetShaderiv");
+    getShaderInfoLog = (GetInfoLogProc)getProc("glGetShaderInfoLog");
+    deleteShader = (DeleteShaderProc)getProc("glDeleteShader");
+    createProgram = (CreateProgramProc)getProc("glCreateProgram");
+    deleteProgram = (DeleteProgramProc)getProc("glDeleteProgram");
+    attachShader = (AttachShaderProc)getProc("glAttachShader");
+    linkProgram = (LinkProgramProc)getProc("glLinkProgram");
+    getProgramiv = (GetProgramivProc)getProc("glGetProgramiv");
+    getProgramInfoLog = (GetInfoLogProc)getProc("glGetProgramInfoLog");
+    useProgram = (UseProgramProc)getProc("glUseProgram");
+    getUniformLocation = (GetUniformLocationProc)getProc("glGetUniformLocation");
+    uniform1f = (Uniform1fProc)getProc("glUniform1f");
+    uniform2f = (Uniform2fProc)getProc("glUniform2f");
+    uniform1fv = (Uniform1fvProc)getProc("glUniform1fv");
+    uniform3fv = (Uniform3fvProc)getProc("glUniform3fv");
+    if (!createShader || !shaderSource || !compileShader || !getShaderiv || !getShaderInfoLog ||
+        !deleteShader || !createProgram || !deleteProgram || !attachShader || !linkProgram ||
+        !getProgramiv || !getProgramInfoLog || !useProgram || !getUniformLocation || !uniform1f ||
+        !uniform2f || !uniform1fv || !uniform3fv) {
+        printf("Shader effects: GL 2.0 entry points missing, fixed-function\n");
+        return;
+    }
+
+    skyEffect.program = linkEffect("sky", SKY_VERTEX_SHADER, VERTEX_COLOR_FRAGMENT_SHADER);
+    if (skyEffect.program) {
+        float top[SKY_GRADIENT_COUNT * 3], bottom[SKY_GRADIENT_COUNT * 3];
+        for (int i = 0; i < SKY_GRADIENT_COUNT; ++i) {
+            memcpy(&top[i * 3], SKY_GRADIENTS[i][0], sizeof(float) * 3);
+            memcpy(&bottom[i * 3], SKY_GRADIENTS[i][1], sizeof(float) * 3);
+        }
+        useProgram(skyEffect.program);
+        uniform1f(getUniformLocation(skyEffect.program, "blendWidth"), TINT_BLEND);
+        uniform1fv(getUniformLocation(skyEffect.program, "momentStart"), 4, TIME_TINT_START);
+        uniform3fv(getUniformLocation(skyEffect.program, "topColors"), SKY_GRADIENT_COUNT, top);
+        uniform3fv(getUniformLocation(skyEffect.program, "bottomColors"), SKY_GRADIENT_COUNT, bottom);
+        skyEffect.dayPhase = getUniformLocation(skyEffect.program, "dayPhase");
+        skyEffect.rain = getUniformLocation(skyEffect.program, "rain");
     }
 
-    if (tm == NIGHT) {
-        r = r * 0.4f + 0.05f; g = g * 0.4f + 0.05f; b = b * 0.4f + 0.15f;
-    } else if (tm == EVENING) {
-        r = r * 0.7f + 0.3f; g = g * 0.7f + 0.2f; b = b * 0.7f + 0.05f;
-    } else if (tm == MORNING) {
-        r = r * 0.8f + 0.2f; g = g * 0.8f + 0.15f; b = b * 0.8f + 0.1f;
+    riverEffect.program = linkEffect("river", RIVER_VERTEX_SHADER, VERTEX_COLOR_FRAGMENT_SHADER);
+    if (riverEffect.program) {
+        riverEffect.flowOffset = getUniformLocation(riverEffect.program, "flowOffset");
+        riverEffect.freezeAmount = getUniformLocation(riverEffect.program, "freezeAmount");
+        riverEffect.riverTop = getUniformLocation(riverEffect.program, "riverTop");
     }
-    glColor4f(r, g, b, alpha);
+
+    crystalEffect.program = linkEffect("crystal", CRYSTAL_VERTEX_SHADER, CRYSTAL_FRAGMENT_SHADER);
+    if (crystalEffect.program) {
+        crystalEffect.glow = getUniformLocation(crystalEffect.program, "glow");
+        crystalEffect.center = getUniformLocation(crystalEffect.program, "center");
+    }
+
+    useProgram(0);
+    printf("Shader effects: GLSL (sky %s, river %s, crystal %s)\n", skyEffect.program ? "on" : "off",
+           riverEffect.program ? "on" : "off", crystalEffect.program ? "on" : "off");
+}
+
+// Binds an effect program, or 0 to return to fixed function.
+void useEffect(GLuint program) {
+#if PROFILE_GL_CALLS
+    glCalls.stateChanges++;
+#endif
+    useProgram(program);
 }
 
 // --- Drawing Primitives ---
+void initUnitCircle() {
+    for (int i = 0; i <= CIRCLE_SEGMENTS; ++i) {
+        float angle = i * 2.0f * PI / CIRCLE_SEGMENTS;
+        unitCircleCos[i] = cosf(angle);
+        unitCircleSin[i] = sinf(angle);
+    }
+}
+
 void drawCircle(float cx, float cy, float radius, float yScale = 1.0f) {
+    float ry = radius * yScale;
     glBegin(GL_TRIANGLE_FAN);
       glVertex2f(cx, cy);
-      for (int i = 0; i <= 30; ++i) {
-          float angle = i * 2.0f * PI / 30.0f;
-          glVertex2f(cx + cosf(angle) * radius, cy + sinf(angle) * radius * yScale);
+      for (int i = 0; i <= CIRCLE_SEGMENTS; ++i) {
+          glVertex2f(cx + unitCircleCos[i] * radius, cy + unitCircleSin[i] * ry);
       }
     glEnd();
 }
 
-void drawPolygon(int sides, float cx, float cy, float radius, float rotation = 0.0f) {
-    glBegin(GL_POLYGON);
-    for (int i = 0; i < sides; ++i) {
-        float angle = i * 2.0f * PI / sides + rotation;
-        glVertex2f(cx + cosf(angle) * radius, cy + sinf(angle) * radius);
+void resetFrameArena() {
+    FrameArena& arena = frameArena;
+    bool overflowed = arena.overflow != NULL;
+    while (arena.overflow) {
+        FrameArenaOverflow* next = arena.overflow->next;
+        ::operator delete(arena.overflow);
+        arena.overflow = next;
     }
-    glEnd();
+    if (arena.frameBytes > arena.peakBytes) arena.peakBytes = arena.frameBytes;
+    if (overflowed || !arena.base) {
+        size_t capacity = max(FRAME_ARENA_INITIAL_BYTES, arena.peakBytes);
+        ::operator delete(arena.base);
+        arena.base = (char*)::operator new(capacity);
+        arena.capacity = capacity;
+    }
+    arena.used = 0;
+    arena.frameBytes = 0;
 }
 
-void drawButterflies() {
-
-    if (currentWeather == RAINY) {
-        return;
+// Returns uninitialised storage for count Ts, valid until the next reset.
+template <typename T>
+T* frameAlloc(size_t count) {
+    FrameArena& arena = frameArena;
+    size_t bytes = (count * sizeof(T) + FRAME_ARENA_ALIGN - 1) & ~(FRAME_ARENA_ALIGN - 1);
+    arena.frameBytes += bytes;
+    if (arena.used + bytes <= arena.capacity) {
+        T* p = (T*)(arena.base + arena.used);
+        arena.used += bytes;
+        return p;
     }
+    FrameArenaOverflow* block = (FrameArenaOverflow*)::operator new(FRAME_ARENA_ALIGN + bytes);
+    block->next = arena.overflow;
+    arena.overflow = block;
+    return (T*)((char*)block + FRAME_ARENA_ALIGN);
+}
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+uint32_t renderKey(int layer, RenderBlend blend, RenderPrimitive primitive, float width) {
+    return (uint32_t)layer << 24 | (uint32_t)blend << 22 | (uint32_t)primitive << 20 | (uint32_t)(width * 16.0f + 0.5f);
+}
 
-    for (const auto& b : butterflies) {
-        glPushMatrix();
-        glTranslatef(b.x, b.y, 0.0f);
-        glRotatef(b.directionAngle * 180.0f / PI - 90.0f, 0, 0, 1);
+// Opens a command; mode is any of GL_TRIANGLES, GL_TRIANGLE_FAN, GL_POLYGON,
+// GL_QUADS, GL_LINES or GL_POINTS, and width is the line width or point size.
+void queueBegin(int layer, RenderBlend blend, GLenum mode, float width = 1.0f) {
+    RenderPrimitive primitive = mode == GL_LINES ? PRIM_LINES : mode == GL_POINTS ? PRIM_POINTS : PRIM_TRIANGLES;
+    renderScratchMode = mode;
+    renderScratchKey = renderKey(layer, blend, primitive, width);
+    renderScratch.clear();
+}
 
-        float wingAngle = 45.0f + 30.0f * sinf(b.flutterPhase);
+void queueColor(float r, float g, float b, float a = 1.0f) {
+    renderColor[0] = r;
+    renderColor[1] = g;
+    renderColor[2] = b;
+    renderColor[3] = a;
+}
 
-        // Wings
-        glColor3f(b.r, b.g, b.b);
-        glPushMatrix();
-            glRotatef(wingAngle, 0, 1, 0);
-            glBegin(GL_TRIANGLES);
-                glVertex2f(0.0f, 0.0f);
-                glVertex2f(-0.03f, 0.02f);
-                glVertex2f(-0.02f, 0.04f);
-            glEnd();
-        glPopMatrix();
-        glPushMatrix();
-            glRotatef(-wingAngle, 0, 1, 0);
-            glBegin(GL_TRIANGLES);
-                glVertex2f(0.0f, 0.0f);
-                glVertex2f(0.03f, 0.02f);
-                glVertex2f(0.02f, 0.04f);
-            glEnd();
-        glPopMatrix();
+// queueColor() with the scene tint applied, like setSceneElementColor().
+void queueSceneColor(float r, float g, float b, float a = 1.0f) {
+    queueColor(tinted(r, 0), tinted(g, 1), tinted(b, 2), a);
+}
 
-        // Body
-        glColor3f(0.1f, 0.1f, 0.1f);
-        glRectf(-0.005f, -0.01f, 0.005f, 0.03f);
+void queueVertex(float x, float y) {
+    renderScratch.push_back({x, y, renderColor[0], renderColor[1], renderColor[2], renderColor[3]});
+}
 
-        glPopMatrix();
+// Closes the open command, turning fans, polygons and quads into triangles.
+void queueEnd() {
+    const vector<RenderVertex>& v = renderScratch;
+    int n = (int)v.size();
+    RenderCommand command = {renderScratchKey, (uint32_t)renderCommands.size(), (int)renderVertices.size(), 0};
+    if (renderScratchMode == GL_TRIANGLE_FAN || renderScratchMode == GL_POLYGON) {
+        for (int i = 1; i + 1 < n; ++i) {
+            renderVertices.push_back(v[0]);
+            renderVertices.push_back(v[i]);
+            renderVertices.push_back(v[i + 1]);
+        }
+    } else if (renderScratchMode == GL_QUADS) {
+        for (int i = 0; i + 3 < n; i += 4) {
+            renderVertices.push_back(v[i]);
+            renderVertices.push_back(v[i + 1]);
+            renderVertices.push_back(v[i + 2]);
+            renderVertices.push_back(v[i]);
+            renderVertices.push_back(v[i + 2]);
+            renderVertices.push_back(v[i + 3]);
+        }
+    } else {
+        renderVertices.insert(renderVertices.end(), v.begin(), v.end());
     }
+    command.count = (int)renderVertices.size() - command.first;
+    if (command.count > 0) renderCommands.push_back(command);
+}
 
-    glDisable(GL_BLEND);
+// Point size (1..POINT_SPRITE_SIZES) a circle is drawn with, or 0 if it is
+// large or squashed enough to need triangles.
+int circlePointSize(float radius, float yScale) {
+    float diameter = 2.0f * radius * pixelsPerUnit;
+    if (diameter >= POINT_SPRITE_MAX_DIAMETER || yScale != 1.0f) return 0;
+    int size = (int)(diameter + 0.5f);
+    return size < 1 ? 1 : size;
 }
 
+// Queues a world-space circle: a smooth point if it is only a few pixels
+// across, otherwise CIRCLE_SEGMENTS triangles.
+void submitCircle(RenderBlend blend, float cx, float cy, float radius, float yScale,
+                  float r, float g, float b, float a, int layer = 0) {
+    queueColor(r, g, b, a);
+    int size = circlePointSize(radius, yScale);
+    if (size > 0) {
+        queueBegin(layer, blend, GL_POINTS, (float)size);
+        queueVertex(cx, cy);
+        queueEnd();
+        return;
+    }
 
+    queueBegin(layer, blend, GL_TRIANGLES);
+    float ry = radius * yScale;
+    for (int i = 0; i < CIRCLE_SEGMENTS; ++i) {
+        queueVertex(cx, cy);
+        queueVertex(cx + unitCircleCos[i] * radius, cy + unitCircleSin[i] * ry);
+        queueVertex(cx + unitCircleCos[i + 1] * radius, cy + unitCircleSin[i + 1] * ry);
+    }
+    queueEnd();
+}
 
-void drawFireflies() {
+// GL state the queue controls; zero/negative fields are unknown.
+struct RenderState {
+    int blendEnabled = -1;
+    int blendFunc = -1;
+    float pointSize = 0.0f;
+    float lineWidth = 0.0f;
+    bool pointSmooth = false;
+};
 
-    if (getTimeMoment() != NIGHT || currentWeather == RAINY || currentWeather == SNOWY) {
-        return;
+// Moves state to what a command key needs and returns the number of state
+// changes that took. With issue false it only counts them.
+int applyRenderState(RenderState& state, uint32_t key, bool issue) {
+    int blend = (key >> 22) & 3;
+    int primitive = (key >> 20) & 3;
+    float width = (key & 0xFFFF) / 16.0f;
+    int changes = 0;
+
+    int enabled = blend != BLEND_OPAQUE;
+    if (enabled != state.blendEnabled) {
+        if (issue) {
+            if (enabled) glEnable(GL_BLEND);
+            else glDisable(GL_BLEND);
+        }
+        state.blendEnabled = enabled;
+        changes++;
+    }
+    if (enabled && blend != state.blendFunc) {
+        if (issue) glBlendFunc(GL_SRC_ALPHA, blend == BLEND_ADDITIVE ? GL_ONE : GL_ONE_MINUS_SRC_ALPHA);
+        state.blendFunc = blend;
+        changes++;
+    }
+    if (primitive == PRIM_POINTS) {
+        if (!state.pointSmooth) {
+            if (issue) glEnable(GL_POINT_SMOOTH);
+            state.pointSmooth = true;
+            changes++;
+        }
+        if (width != state.pointSize) {
+            if (issue) glPointSize(width);
+            state.pointSize = width;
+            changes++;
+        }
+    } else if (primitive == PRIM_LINES && width != state.lineWidth) {
+        if (issue) glLineWidth(width);
+        state.lineWidth = width;
+        changes++;
     }
+    return changes;
+}
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+// Draws and empties the queue. Call it before immediate-mode drawing that
+// has to appear above what has been queued.
+void flushRenderQueue() {
+    int n = (int)renderCommands.size();
+    if (n == 0) return;
 
-    for (const auto& f : fireflies) {
-        float glowIntensity = 0.6f + 0.4f * sinf(f.glowPhase);
-        glColor4f(1.0f, 1.0f, 0.7f, glowIntensity);
+    RenderQueueStats& stats = renderQueueFrame;
+    RenderState submitted;
+    for (const RenderCommand& c : renderCommands) {
+        stats.stateChangesSubmitted += applyRenderState(submitted, c.key, false);
+    }
+    stats.commands += n;
+    stats.drawCallsSubmitted += n;
+
+    sort(renderCommands.begin(), renderCommands.end(), [](const RenderCommand& a, const RenderCommand& b) {
+        return a.key != b.key ? a.key < b.key : a.seq < b.seq;
+    });
+
+    // Lay the vertices out in draw order, so each run is one contiguous range
+    RenderVertex* stream = frameAlloc<RenderVertex>(renderVertices.size());
+    int streamCount = 0;
+    for (RenderCommand& c : renderCommands) {
+        memcpy(stream + streamCount, &renderVertices[c.first], c.count * sizeof(RenderVertex));
+        c.first = streamCount;
+        streamCount += c.count;
+    }
 
-        glPushMatrix();
-        glTranslatef(f.x, f.y, f.z);
+    glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_POINT_BIT | GL_LINE_BIT);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(2, GL_FLOAT, sizeof(RenderVertex), &stream->x);
+    glColorPointer(4, GL_FLOAT, sizeof(RenderVertex), &stream->r);
+
+    RenderState issued;
+    for (int i = 0; i < n;) {
+        uint32_t key = renderCommands[i].key;
+        int first = renderCommands[i].first;
+        int count = 0;
+        for (; i < n && renderCommands[i].key == key; ++i) count += renderCommands[i].count;
+
+        stats.stateChangesIssued += applyRenderState(issued, key, true);
+        int primitive = (key >> 20) & 3;
+        glDrawArrays(primitive == PRIM_POINTS ? GL_POINTS : primitive == PRIM_LINES ? GL_LINES : GL_TRIANGLES, first, count);
+        stats.drawCallsIssued++;
+    }
 
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glPopAttrib();
 
-        float size = 0.012f;
-        glBegin(GL_QUADS);
-            glVertex3f(-size/2, -size/2, 0.0f);
-            glVertex3f( size/2, -size/2, 0.0f);
-            glVertex3f( size/2,  size/2, 0.0f);
-            glVertex3f(-size/2,  size/2, 0.0f);
-        glEnd();
+    renderCommands.clear();
+    renderVertices.clear();
+}
 
+// --- Actor Sprites ---
+
+const ActorSpriteDef ACTOR_SPRITES[ACTOR_SPRITE_COUNT] = {
+    {16, -0.03f, -0.085f, 0.03f, 0.05f, 1.0f, true, true, drawElfPose},               // SPRITE_ELF
+    {16, -0.035f, -0.015f, 0.035f, 0.045f, 1.0f, true, true, drawButterflyPose},      // SPRITE_BUTTERFLY
+    {16, -0.025f, -0.025f, 0.025f, 0.025f, 1.0f, true, false, drawBirdPose},          // SPRITE_BIRD
+    {1, -0.5f, -1.0f, 0.5f, 1.0f, 0.03f, false, true,                                 // SPRITE_LEAF
+     [](float, SpriteLayer layer) { drawLeafPose(layer); }},
+    {16, -0.13f, -0.1f, 0.17f, 0.21f, 0.65f, true, false, drawFoxBodyPose},           // SPRITE_FOX_BODY
+    {1, -0.165f, -0.055f, 0.015f, 0.055f, 0.65f, true, false,                         // SPRITE_FOX_TAIL
+     [](float, SpriteLayer layer) { drawFoxTailPose(layer); }}
+};
 
-        glColor4f(1.0f, 1.0f, 0.7f, glowIntensity * 0.3f);
-        drawCircle(0, 0, size * 2.0f);
+// Colours a fixed-colour part of a pose being baked. In the mask layer the
+// part is drawn transparent instead, so it still hides the parts under it.
+void spritePartColor(SpriteLayer layer, float r, float g, float b, bool tint = true) {
+    if (layer == SPRITE_LAYER_MASK) glColor4f(0.0f, 0.0f, 0.0f, 0.0f);
+    else if (tint) setSceneElementColor(r, g, b);
+    else glColor4f(r, g, b, 1.0f);
+}
 
-        glPopMatrix();
+// Colours the part of a pose that takes the instance's colour: white in the
+// mask layer and cut out of the base layer.
+void spriteInstanceColor(SpriteLayer layer) {
+    if (layer == SPRITE_LAYER_MASK) glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+    else glColor4f(0.0f, 0.0f, 0.0f, 0.0f);
+}
+
+// Nearest baked pose to an animation phase (radians, one cycle per 2 PI).
+int spriteFrame(ActorSprite sprite, float phase) {
+    int frames = ACTOR_SPRITES[sprite].frames;
+    int frame = (int)floorf(phase * (frames / (2.0f * PI)) + 0.5f) % frames;
+    return frame < 0 ? frame + frames : frame;
+}
+
+SpriteCell& spriteCell(ActorSprite sprite, int frame, SpriteLayer layer) {
+    return spriteCells[spriteFirstCell[sprite] + frame * 2 + layer];
+}
+
+// Sizes every pose layer for the current pixelsPerUnit and packs them into
+// rows of the atlas.
+void layoutSpriteAtlas() {
+    int cell = 0, x = 0, y = 0, rowHeight = 0;
+    for (int s = 0; s < ACTOR_SPRITE_COUNT; ++s) {
+        const ActorSpriteDef& def = ACTOR_SPRITES[s];
+        float pixelsPerPoseUnit = def.bakeScale * pixelsPerUnit;
+        int width = (int)ceilf((def.x1 - def.x0) * pixelsPerPoseUnit) + 2 * SPRITE_CELL_MARGIN;
+        int height = (int)ceilf((def.y1 - def.y0) * pixelsPerPoseUnit) + 2 * SPRITE_CELL_MARGIN;
+        spriteFirstCell[s] = cell;
+        for (int i = 0; i < def.frames * 2; ++i) {
+            SpriteCell& c = spriteCells[cell++];
+            memset(&c, 0, sizeof(c));
+            if (!(i % 2 == SPRITE_LAYER_BASE ? def.hasBase : def.hasMask)) continue;
+
+            if (x + width > SPRITE_ATLAS_WIDTH) {
+                x = 0;
+                y += rowHeight;
+                rowHeight = 0;
+            }
+            c.px = x;
+            c.py = y;
+            c.width = width;
+            c.height = height;
+            c.x0 = def.x0 - SPRITE_CELL_MARGIN / pixelsPerPoseUnit;
+            c.y0 = def.y0 - SPRITE_CELL_MARGIN / pixelsPerPoseUnit;
+            c.x1 = c.x0 + width / pixelsPerPoseUnit;
+            c.y1 = c.y0 + height / pixelsPerPoseUnit;
+            x += width;
+            rowHeight = max(rowHeight, height);
+        }
+    }
+
+    spriteAtlasHeight = 1;
+    while (spriteAtlasHeight < y + rowHeight) spriteAtlasHeight *= 2;
+    for (int i = 0; i < cell; ++i) {
+        SpriteCell& c = spriteCells[i];
+        c.u0 = (float)c.px / SPRITE_ATLAS_WIDTH;
+        c.v0 = (float)c.py / spriteAtlasHeight;
+        c.u1 = (float)(c.px + c.width) / SPRITE_ATLAS_WIDTH;
+        c.v1 = (float)(c.py + c.height) / spriteAtlasHeight;
     }
-    glDisable(GL_BLEND);
 }
 
-// --- Drawing Functions ---
+// Loads the GL_EXT_framebuffer_object entry points and creates the
+// framebuffer the atlas is baked through. Without them the atlas is baked
+// through the back buffer.
+void initSpriteAtlas(void* (*getProc)(const char*)) {
+    const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+    if (extensions && strstr(extensions, "GL_EXT_framebuffer_object")) {
+        genFramebuffers = (GenFramebuffersProc)getProc("glGenFramebuffersEXT");
+        bindFramebuffer = (BindFramebufferProc)getProc("glBindFramebufferEXT");
+        framebufferTexture2D = (FramebufferTexture2DProc)getProc("glFramebufferTexture2DEXT");
+        checkFramebufferStatus = (CheckFramebufferStatusProc)getProc("glCheckFramebufferStatusEXT");
+    }
+    if (!genFramebuffers || !bindFramebuffer || !framebufferTexture2D || !checkFramebufferStatus) {
+        printf("Sprite atlas: no framebuffer objects, baking through the back buffer\n");
+        return;
+    }
+    genFramebuffers(1, &spriteBakeFramebuffer);
+}
 
+// Binds the bake framebuffer with the atlas as its colour buffer. Returns
+// false, with the window's framebuffer still bound, if that is unavailable
+// or incomplete.
+bool bindSpriteBakeTarget() {
+    if (spriteBakeFramebuffer == 0) return false;
+    bindFramebuffer(GL_FRAMEBUFFER_EXT, spriteBakeFramebuffer);
+    framebufferTexture2D(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, spriteAtlasTexture, 0);
+    if (checkFramebufferStatus(GL_FRAMEBUFFER_EXT) == GL_FRAMEBUFFER_COMPLETE_EXT) return true;
+    bindFramebuffer(GL_FRAMEBUFFER_EXT, 0);
+    return false;
+}
 
-void drawWishingWell(float x, float y) {
+// Draws each pose into its atlas cell, either directly through the bake
+// framebuffer or into the corner of the back buffer and copied from there.
+// Base layers are always baked, masks only when asked. Must run before the
+// frame's glClear.
+void bakeSpriteCells(bool masks) {
+    bool direct = bindSpriteBakeTarget();
+    glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_SCISSOR_BIT | GL_VIEWPORT_BIT |
+                 GL_CURRENT_BIT | GL_LINE_BIT | GL_TEXTURE_BIT);
+    glDisable(GL_BLEND);
+    glEnable(GL_SCISSOR_TEST);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    if (!direct) glBindTexture(GL_TEXTURE_2D, spriteAtlasTexture);
+    glMatrixMode(GL_PROJECTION);
     glPushMatrix();
-    glTranslatef(x, y, 0.0f);
-    float scale = 0.7f;
-    glScalef(scale, scale, 1.0f);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
 
-    // Rope
-    setSceneElementColor(0.6f, 0.5f, 0.3f);
-    glLineWidth(2.0f);
-    glBegin(GL_LINES);
-        glVertex2f(0.0f, 0.22f);
-        glVertex2f(0.0f, -0.05f);
-    glEnd();
-    // Axle
-    setSceneElementColor(0.35f, 0.2f, 0.1f);
-    glRectf(-0.18f, 0.2f, 0.18f, 0.24f);
-    // Wheel
-    drawCircle(0.0f, 0.22f, 0.04f);
+    for (int s = 0; s < ACTOR_SPRITE_COUNT; ++s) {
+        const ActorSpriteDef& def = ACTOR_SPRITES[s];
+        for (int frame = 0; frame < def.frames; ++frame) {
+            for (int layer = SPRITE_LAYER_BASE; layer <= SPRITE_LAYER_MASK; ++layer) {
+                if (layer == SPRITE_LAYER_MASK && !masks) continue;
+                const SpriteCell& c = spriteCell((ActorSprite)s, frame, (SpriteLayer)layer);
+                if (c.width == 0) continue;
+
+                int x = direct ? c.px : 0, y = direct ? c.py : 0;
+                glViewport(x, y, c.width, c.height);
+                glScissor(x, y, c.width, c.height);
+                glClear(GL_COLOR_BUFFER_BIT);
+                glMatrixMode(GL_PROJECTION);
+                glLoadIdentity();
+                glOrtho(c.x0, c.x1, c.y0, c.y1, -1.0, 1.0);
+                glMatrixMode(GL_MODELVIEW);
+                def.drawPose(frame * 2.0f * PI / def.frames, (SpriteLayer)layer);
+                if (!direct) glCopyTexSubImage2D(GL_TEXTURE_2D, 0, c.px, c.py, 0, 0, c.width, c.height);
+            }
+        }
+    }
 
-    // Bucket
-    setSceneElementColor(0.55f, 0.35f, 0.15f);
-    glBegin(GL_QUADS);
-        glVertex2f(-0.03f, -0.05f);
-        glVertex2f(0.03f, -0.05f);
-        glVertex2f(0.04f, -0.12f);
-        glVertex2f(-0.04f, -0.12f);
-    glEnd();
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopAttrib();
+    if (direct) bindFramebuffer(GL_FRAMEBUFFER_EXT, 0);
+}
 
-     // --- Stone Base ---
-    // Main Base
-    setSceneElementColor(0.5f, 0.5f, 0.55f);
-    glBegin(GL_QUADS);
-        glVertex2f(-0.22f, -0.2f);
+// Rebakes the atlas if the window size or the scene tint has changed since it
+// was last baked. Called once per frame after updateSceneTint(), before the
+// framebuffer is cleared.
+void updateSpriteAtlas() {
+    bool resized = spriteAtlasPixelsPerUnit != pixelsPerUnit;
+    if (!resized && memcmp(&spriteAtlasTint, &sceneTint, sizeof(SceneTint)) == 0) {
+        return;
+    }
+
+    if (resized) {
+        layoutSpriteAtlas();
+        if (spriteAtlasTexture == 0) glGenTextures(1, &spriteAtlasTexture);
+        glBindTexture(GL_TEXTURE_2D, spriteAtlasTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, SPRITE_ATLAS_WIDTH, spriteAtlasHeight, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+    bakeSpriteCells(resized);
+
+    spriteAtlasPixelsPerUnit = pixelsPerUnit;
+    spriteAtlasTint = sceneTint;
+}
+
+// Queues one actor for the next flushSprites() call: its base layer, then its
+// mask layer in the instance colour.
+void submitSprite(ActorSprite sprite, int frame, const SpriteInstance& instance) {
+    const ActorSpriteDef& def = ACTOR_SPRITES[sprite];
+    float c = 1.0f, s = 0.0f;
+    if (instance.rotation != 0.0f) {
+        c = cosf(instance.rotation);
+        s = sinf(instance.rotation);
+    }
+
+    for (int layer = SPRITE_LAYER_BASE; layer <= SPRITE_LAYER_MASK; ++layer) {
+        if (!(layer == SPRITE_LAYER_BASE ? def.hasBase : def.hasMask)) continue;
+        const SpriteCell& cell = spriteCell(sprite, frame, (SpriteLayer)layer);
+        float a = instance.a;
+        float r = a, g = a, b = a;
+        if (layer == SPRITE_LAYER_MASK) {
+            r = instance.r * a;
+            g = instance.g * a;
+            b = instance.b * a;
+        }
+
+        const float corners[4][4] = {
+            {cell.x0, cell.y0, cell.u0, cell.v0}, {cell.x1, cell.y0, cell.u1, cell.v0},
+            {cell.x1, cell.y1, cell.u1, cell.v1}, {cell.x0, cell.y1, cell.u0, cell.v1}
+        };
+        for (const auto& corner : corners) {
+            float lx = corner[0] * instance.scaleX;
+            float ly = corner[1] * instance.scaleY;
+            spriteStream.xy.push_back(instance.x + lx * c - ly * s);
+            spriteStream.xy.push_back(instance.y + lx * s + ly * c);
+            spriteStream.uv.push_back(corner[2]);
+            spriteStream.uv.push_back(corner[3]);
+            spriteStream.rgba.push_back(r);
+            spriteStream.rgba.push_back(g);
+            spriteStream.rgba.push_back(b);
+            spriteStream.rgba.push_back(a);
+        }
+    }
+}
+
+// Draws every queued sprite as one batch of textured quads.
+void flushSprites() {
+    if (spriteStream.xy.empty()) return;
+
+    glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_TEXTURE_BIT);
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, spriteAtlasTexture);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(2, GL_FLOAT, 0, spriteStream.xy.data());
+    glTexCoordPointer(2, GL_FLOAT, 0, spriteStream.uv.data());
+    glColorPointer(4, GL_FLOAT, 0, spriteStream.rgba.data());
+    glDrawArrays(GL_QUADS, 0, spriteStream.xy.size() / 2);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glPopAttrib();
+
+    spriteStream.xy.clear();
+    spriteStream.uv.clear();
+    spriteStream.rgba.clear();
+}
+
+void drawPolygon(int sides, float cx, float cy, float radius, float rotation = 0.0f) {
+    glBegin(GL_POLYGON);
+    for (int i = 0; i < sides; ++i) {
+        float angle = i * 2.0f * PI / sides + rotation;
+        glVertex2f(cx + cosf(angle) * radius, cy + sinf(angle) * radius);
+    }
+    glEnd();
+}
+
+void drawButterflyPose(float phase, SpriteLayer layer) {
+    float wingAngle = 45.0f + 30.0f * sinf(phase);
+
+    // Wings
+    spriteInstanceColor(layer);
+    glPushMatrix();
+        glRotatef(wingAngle, 0, 1, 0);
+        glBegin(GL_TRIANGLES);
+            glVertex2f(0.0f, 0.0f);
+            glVertex2f(-0.03f, 0.02f);
+            glVertex2f(-0.02f, 0.04f);
+        glEnd();
+    glPopMatrix();
+    glPushMatrix();
+        glRotatef(-wingAngle, 0, 1, 0);
+        glBegin(GL_TRIANGLES);
+            glVertex2f(0.0f, 0.0f);
+            glVertex2f(0.03f, 0.02f);
+            glVertex2f(0.02f, 0.04f);
+        glEnd();
+    glPopMatrix();
+
+    // Body
+    spritePartColor(layer, 0.1f, 0.1f, 0.1f, false);
+    glRectf(-0.005f, -0.01f, 0.005f, 0.03f);
+}
+
+void drawButterflies() {
+
+    if (currentWeather == RAINY) {
+        return;
+    }
+
+    for (const auto& b : view.butterflies) {
+        SpriteInstance instance = {interpolated(b.prevX, b.x, 1.0f), interpolated(b.prevY, b.y, 1.0f),
+                                   b.directionAngle - PI / 2.0f, 1.0f, 1.0f, b.r, b.g, b.b, 1.0f};
+        submitSprite(SPRITE_BUTTERFLY, spriteFrame(SPRITE_BUTTERFLY, b.flutterPhase), instance);
+    }
+    flushSprites();
+}
+
+
+
+void drawFireflies() {
+
+    if (getTimeMoment() != NIGHT || currentWeather == RAINY || currentWeather == SNOWY) {
+        return;
+    }
+
+    // Bodies and glows are all additive, so they batch into one or two draws
+    for (const auto& f : view.fireflies) {
+        float glowIntensity = 0.6f + 0.4f * sinf(f.glowPhase);
+        float size = 0.012f;
+
+        queueColor(1.0f, 1.0f, 0.7f, glowIntensity);
+        queueBegin(0, BLEND_ADDITIVE, GL_QUADS);
+            queueVertex(f.x - size/2, f.y - size/2);
+            queueVertex(f.x + size/2, f.y - size/2);
+            queueVertex(f.x + size/2, f.y + size/2);
+            queueVertex(f.x - size/2, f.y + size/2);
+        queueEnd();
+
+        submitCircle(BLEND_ADDITIVE, f.x, f.y, size * 2.0f, 1.0f, 1.0f, 1.0f, 0.7f, glowIntensity * 0.3f);
+    }
+
+    flushRenderQueue();
+}
+
+// --- Drawing Functions ---
+
+
+void drawWishingWell(float x, float y) {
+    glPushMatrix();
+    glTranslatef(x, y, 0.0f);
+    float scale = 0.7f;
+    glScalef(scale, scale, 1.0f);
+
+    // Rope
+    setSceneElementColor(0.6f, 0.5f, 0.3f);
+    glLineWidth(2.0f);
+    glBegin(GL_LINES);
+        glVertex2f(0.0f, 0.22f);
+        glVertex2f(0.0f, -0.05f);
+    glEnd();
+    // Axle
+    setSceneElementColor(0.35f, 0.2f, 0.1f);
+    glRectf(-0.18f, 0.2f, 0.18f, 0.24f);
+    // Wheel
+    drawCircle(0.0f, 0.22f, 0.04f);
+
+    // Bucket
+    setSceneElementColor(0.55f, 0.35f, 0.15f);
+    glBegin(GL_QUADS);
+        glVertex2f(-0.03f, -0.05f);
+        glVertex2f(0.03f, -0.05f);
+        glVertex2f(0.04f, -0.12f);
+        glVertex2f(-0.04f, -0.12f);
+    glEnd();
+
+     // --- Stone Base ---
+    // Main Base
+    setSceneElementColor(0.5f, 0.5f, 0.55f);
+    glBegin(GL_QUADS);
+        glVertex2f(-0.22f, -0.2f);
         glVertex2f(0.22f, -0.2f);
         glVertex2f(0.2f, 0.1f);
         glVertex2f(-0.2f, 0.1f);
@@ -435,7 +1831,7 @@ void drawWishingWell(float x, float y) {
 
 
 void drawCampfire() {
-    for (const auto& fire : campfires) {
+    for (const auto& fire : view.campfires) {
         glPushMatrix();
         glTranslatef(fire.x, fire.y, 0.0f);
 
@@ -479,115 +1875,91 @@ void drawCampfire() {
 
             glPopMatrix();
             glPopAttrib();
-
-            // --- Draw Sparks and Smoke ---
-            drawParticles();
         }
         glPopMatrix();
     }
 }
 
 
-void drawFlowersAndBushes() {
-    // --- Draw Upgraded Bushes ---
-    auto drawUpgradedBush = [](float x, float y, float scale = 1.0f) {
-        glPushMatrix();
-        glTranslatef(x, y, 0);
-        glScalef(scale, scale, 1.0f);
-
-        // Dark base layer
-        setSceneElementColor(0.1f, 0.4f, 0.15f);
-        drawCircle(0.0f, -0.03f, 0.08f);
-        drawCircle(-0.04f, -0.01f, 0.06f);
-        drawCircle(0.04f, -0.01f, 0.07f);
-
-        // Mid layer
-        setSceneElementColor(0.15f, 0.55f, 0.2f);
-        drawCircle(0.0f, 0.0f, 0.07f);
-        drawCircle(-0.03f, 0.02f, 0.05f);
-        drawCircle(0.05f, 0.02f, 0.06f);
-
-        // Highlight layer
-        setSceneElementColor(0.2f, 0.7f, 0.25f);
-        drawCircle(0.0f, 0.02f, 0.05f);
-        drawCircle(-0.02f, 0.03f, 0.04f);
-        drawCircle(0.03f, 0.03f, 0.05f);
+void drawBush(float x, float y, float scale) {
+    glPushMatrix();
+    glTranslatef(x, y, 0);
+    glScalef(scale, scale, 1.0f);
 
-        glPopMatrix();
-    };
+    // Dark base layer
+    setSceneElementColor(0.1f, 0.4f, 0.15f);
+    drawCircle(0.0f, -0.03f, 0.08f);
+    drawCircle(-0.04f, -0.01f, 0.06f);
+    drawCircle(0.04f, -0.01f, 0.07f);
 
-    drawUpgradedBush(-1.8f, -0.7f, 0.8f);
-    drawUpgradedBush(-0.79f, -0.57f, 0.7f);
-    drawUpgradedBush(0.5f, -0.6f, 1.0f);
-    drawUpgradedBush(2.4f, -0.5f, 0.8f);
-    drawUpgradedBush(2.35f, -0.72f, 0.7f);
-    drawUpgradedBush(-2.4f, -0.5f, 0.9f);
+    // Mid layer
+    setSceneElementColor(0.15f, 0.55f, 0.2f);
+    drawCircle(0.0f, 0.0f, 0.07f);
+    drawCircle(-0.03f, 0.02f, 0.05f);
+    drawCircle(0.05f, 0.02f, 0.06f);
 
+    // Highlight layer
+    setSceneElementColor(0.2f, 0.7f, 0.25f);
+    drawCircle(0.0f, 0.02f, 0.05f);
+    drawCircle(-0.02f, 0.03f, 0.04f);
+    drawCircle(0.03f, 0.03f, 0.05f);
 
-    auto drawFlower = [](float x, float y, float r, float g, float b, float scale = 1.0f) {
-        glPushMatrix();
-        glTranslatef(x, y, 0);
-        glScalef(scale, scale, 1.0f);
+    glPopMatrix();
+}
 
-        // Stem
-        setSceneElementColor(0.1f, 0.5f, 0.15f);
-        glRectf(-0.005f, -0.05f, 0.005f, 0.0f);
+void drawFlower(float x, float y, const float* petal, float scale) {
+    glPushMatrix();
+    glTranslatef(x, y, 0);
+    glScalef(scale, scale, 1.0f);
 
-        // Flower Head with sway
-        glPushMatrix();
+    // Stem
+    setSceneElementColor(0.1f, 0.5f, 0.15f);
+    glRectf(-0.005f, -0.05f, 0.005f, 0.0f);
 
+    // Flower Head with sway
+    glPushMatrix();
 
-        float swayOffset = 0.01f * sinf(crystalGlow * 1.5f);
-        glTranslatef(swayOffset, 0.0f, 0.0f);
 
-        setSceneElementColor(r, g, b);
-        drawPolygon(5, 0, 0, 0.02f);
-        setSceneElementColor(1.0f, 1.0f, 0.3f);
-        drawCircle(0, 0, 0.008f);
+    float swayOffset = 0.01f * sinf(view.crystalGlow * 1.5f);
+    glTranslatef(swayOffset, 0.0f, 0.0f);
 
-        glPopMatrix();
+    setSceneElementColor(petal[0], petal[1], petal[2]);
+    drawPolygon(5, 0, 0, 0.02f);
+    setSceneElementColor(1.0f, 1.0f, 0.3f);
+    drawCircle(0, 0, 0.008f);
 
-        glPopMatrix();
-    };
+    glPopMatrix();
 
-    drawFlower(-0.5f, -0.8f, 1.0f, 0.4f, 0.4f);
-    drawFlower(-0.45f, -0.83f, 1.0f, 0.4f, 0.4f, 0.8f);
-    drawFlower(0.8f, -0.6f, 0.9f, 0.9f, 1.0f);
-    drawFlower(-2.32f, -0.2f, 0.9f, 0.9f, 1.0f);
-    drawFlower(2.2f, -0.7f, 0.6f, 0.6f, 1.0f);
-    drawFlower(-2.31f, -0.28f, 0.6f, 0.6f, 1.0f);
-    drawFlower(2.25f, -0.72f, 0.6f, 0.6f, 1.0f, 0.9f);
-    drawFlower(-2.31f, -0.78f, 0.6f, 0.6f, 1.0f);
-    drawFlower(-2.35f, -0.75f, 1.0f, 0.4f, 0.4f);
-    drawFlower(-2.4f, -0.78f, 0.9f, 0.9f, 1.0f);
-    drawFlower(0.7f, -0.45f, 1.0f, 0.4f, 0.4f, 0.8f);
-    drawFlower(0.76f, -0.45f, 1.0f, 0.9f, 0.9f, 1.0f);
+    glPopMatrix();
 }
 
 void drawSky() {
-    TimeMoment tm = getTimeMoment();
-    float r1, g1, b1, r2, g2, b2;
-
-    if (currentWeather == RAINY) {
-        r1 = 0.3f; g1 = 0.35f; b1 = 0.4f; r2 = 0.4f; g2 = 0.45f; b2 = 0.5f;
-    } else {
-        if (tm == MORNING) { r1 = 0.6f; g1 = 0.7f; b1 = 1.0f; r2 = 1.0f; g2 = 0.9f;  b2 = 0.8f; }
-        else if (tm == NOON)    { r1 = 0.1f; g1 = 0.6f; b1 = 1.0f; r2 = 0.7f; g2 = 0.85f; b2 = 1.0f; }
-        else if (tm == EVENING) { r1 = 0.9f; g1 = 0.5f; b1 = 0.2f; r2 = 1.0f; g2 = 0.8f;  b2 = 0.4f; }
-        else { r1 = 0.0f; g1 = 0.0f; b1 = 0.1f; r2 = 0.1f; g2 = 0.1f;  b2 = 0.35f; }
+    if (skyEffect.program) {
+        useEffect(skyEffect.program);
+        uniform1f(skyEffect.dayPhase, view.dayNightPhase);
+        uniform1f(skyEffect.rain, currentWeather == RAINY ? 1.0f : 0.0f);
+        glBegin(GL_QUADS);
+          glVertex2f(-2.5f, 1.5f);
+          glVertex2f( 2.5f, 1.5f);
+          glVertex2f( 2.5f, -1.5f);
+          glVertex2f(-2.5f, -1.5f);
+        glEnd();
+        useEffect(0);
+        return;
     }
 
+    const float (*gradient)[3] = SKY_GRADIENTS[currentWeather == RAINY ? SKY_GRADIENT_COUNT - 1 : getTimeMoment()];
     glBegin(GL_QUADS);
-      glColor3f(r1, g1, b1); glVertex2f(-2.5f, 1.5f);
-      glColor3f(r1, g1, b1); glVertex2f( 2.5f, 1.5f);
-      glColor3f(r2, g2, b2); glVertex2f( 2.5f, -1.5f);
-      glColor3f(r2, g2, b2); glVertex2f(-2.5f, -1.5f);
+      glColor3fv(gradient[0]); glVertex2f(-2.5f, 1.5f);
+      glColor3fv(gradient[0]); glVertex2f( 2.5f, 1.5f);
+      glColor3fv(gradient[1]); glVertex2f( 2.5f, -1.5f);
+      glColor3fv(gradient[1]); glVertex2f(-2.5f, -1.5f);
     glEnd();
 }
 
 void drawMoon() {
 
-    float moonPhase = (dayNightPhase - 0.5f) * 2.0f;
+    float moonPhase = (view.dayNightPhase - 0.5f) * 2.0f;
 
 
     float moonX = -2.8f + (moonPhase * 5.6f);
@@ -615,9 +1987,7 @@ void drawMoon() {
 }
 
 void drawClouds() {
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
+    double tick = renderTick();
     for (int i = 0; i < CLOUD_COUNT; ++i) {
         TimeMoment tm = getTimeMoment();
         float main_r, main_g, main_b;
@@ -644,36 +2014,34 @@ void drawClouds() {
         }
 
 
-        glColor4f(shadow_r, shadow_g, shadow_b, 1.0f);
-        for (int j = 0; j < clouds[i].num_circles; ++j) {
-            const CloudCircle& c = clouds[i].circles[j];
-            drawCircle(clouds[i].x + c.x_offset, clouds[i].y + c.y_offset - 0.015f, c.radius, c.yScale);
+        float cloudX = cloudXAt(view.clouds[i], tick);
+
+        for (int j = 0; j < view.clouds[i].num_circles; ++j) {
+            const CloudCircle& c = view.clouds[i].circles[j];
+            submitCircle(BLEND_ALPHA, cloudX + c.x_offset, view.clouds[i].y + c.y_offset - 0.015f, c.radius, c.yScale,
+                         shadow_r, shadow_g, shadow_b, 1.0f);
         }
 
 
-        glColor4f(main_r, main_g, main_b, 1.0f);
-        for (int j = 0; j < clouds[i].num_circles; ++j) {
-            const CloudCircle& c = clouds[i].circles[j];
-            drawCircle(clouds[i].x + c.x_offset, clouds[i].y + c.y_offset, c.radius, c.yScale);
+        for (int j = 0; j < view.clouds[i].num_circles; ++j) {
+            const CloudCircle& c = view.clouds[i].circles[j];
+            submitCircle(BLEND_ALPHA, cloudX + c.x_offset, view.clouds[i].y + c.y_offset, c.radius, c.yScale,
+                         main_r, main_g, main_b, 1.0f);
         }
     }
 
-    glDisable(GL_BLEND);
+    flushRenderQueue();
 }
 
 void drawStars() {
     if (getTimeMoment() != NIGHT) return;
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-
+    double tick = renderTick();
     for (int i = 0; i < STAR_COUNT; ++i) {
-        glColor4f(1.0f, 1.0f, 0.9f, stars[i].alpha);
-        drawCircle(stars[i].x, stars[i].y, stars[i].radius);
+        submitCircle(BLEND_ADDITIVE, view.stars[i].x, view.stars[i].y, view.stars[i].radius, 1.0f,
+                     1.0f, 1.0f, 0.9f, starAlphaAt(view.stars[i], tick));
     }
-
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glDisable(GL_BLEND);
+    flushRenderQueue();
 }
 
 
@@ -681,9 +2049,9 @@ void drawSunAndMoon() {
     glPushAttrib(GL_ENABLE_BIT);
     glDisable(GL_LIGHTING);
 
-    if (dayNightPhase >= 0.0f && dayNightPhase < 0.5f) {
+    if (view.dayNightPhase >= 0.0f && view.dayNightPhase < 0.5f) {
 
-        float sunPhase = dayNightPhase * 2.0f;
+        float sunPhase = view.dayNightPhase * 2.0f;
         float sunX = -2.8f + (sunPhase * 5.6f);
         float sunY = -0.2f + 1.5f * sinf(sunPhase * PI);
 
@@ -708,14 +2076,14 @@ void drawSunAndMoon() {
 
             // ---  Sun rays ---
             glPushMatrix();
-            glRotatef(crystalGlow * 10.0f, 0, 0, 1);
+            glRotatef(view.crystalGlow * 10.0f, 0, 0, 1);
 
             int num_rays = 8;
             glColor4f(glow_r, glow_g, glow_b, 0.20f);
             glBegin(GL_TRIANGLES);
             for (int i = 0; i < num_rays; ++i) {
                 float angle = (i / (float)num_rays) * 2.0f * PI;
-                float rayLength = 0.22f + 0.03f * sinf(crystalGlow * 0.8f + i);
+                float rayLength = 0.22f + 0.03f * sinf(view.crystalGlow * 0.8f + i);
                 float baseWidth = 0.04f;
 
                 glVertex2f(0.0f, 0.0f);
@@ -814,19 +2182,12 @@ void drawHangingLantern(float x, float y) {
         glVertex2f(x - 0.02f, y - 0.06f);
     glEnd();
 
-    // Light
+    // Light, queued and flushed by drawGreatTree()
     if (getTimeMoment() == NIGHT) {
-        glPushAttrib(GL_ENABLE_BIT);
-        glDisable(GL_LIGHTING);
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE);
         // Outer Glow
-        glColor4f(1.0f, 0.9f, 0.5f, 0.2f + 0.05f * sinf(crystalGlow * 2.0f));
-        drawCircle(x, y - 0.03f, 0.06f);
+        submitCircle(BLEND_ADDITIVE, x, y - 0.03f, 0.06f, 1.0f, 1.0f, 0.9f, 0.5f, 0.2f + 0.05f * sinf(view.crystalGlow * 2.0f));
         // Inner Core
-        glColor4f(1.0f, 1.0f, 0.8f, 1.0f);
-        drawCircle(x, y - 0.03f, 0.015f);
-        glPopAttrib();
+        submitCircle(BLEND_ADDITIVE, x, y - 0.03f, 0.015f, 1.0f, 1.0f, 1.0f, 0.8f, 1.0f);
     } else {
         setSceneElementColor(1.0f, 1.0f, 0.8f);
         drawCircle(x, y - 0.03f, 0.015f);
@@ -844,7 +2205,7 @@ void drawHangingMoss(float x, float y, float scale) {
     for (int i = 0; i <= 15; ++i) {
         float t = i / 15.0f;
 
-        float centerX = x + 0.02f * sinf(t * 7.0f + dayNightPhase * 10.0f);
+        float centerX = x + 0.02f * sinf(t * 7.0f + view.dayNightPhase * 10.0f);
         float centerY = y - t * 0.25f * scale;
 
 
@@ -861,7 +2222,7 @@ void drawHangingMoss(float x, float y, float scale) {
         float t = i / 15.0f;
 
 
-        float centerX = x + 0.02f * sinf(t * 7.0f + dayNightPhase * 10.0f);
+        float centerX = x + 0.02f * sinf(t * 7.0f + view.dayNightPhase * 10.0f);
         float centerY = y - t * 0.25f * scale;
 
         glPushMatrix();
@@ -973,16 +2334,17 @@ void drawRainAndSplashes() {
     glLineWidth(1.5f);
     glColor4f(0.8f, 0.9f, 1.0f, 0.6f);
     glBegin(GL_LINES);
-    for (int i = 0; i < RAIN_COUNT; ++i) {
-        glVertex2f(raindrops[i].x, raindrops[i].y);
-        glVertex2f(raindrops[i].x, raindrops[i].y - 0.05f);
+    for (int i = 0; i < view.rainCount; ++i) {
+        glVertex2f(view.rainX[i], view.rainY[i]);
+        glVertex2f(view.rainX[i], view.rainY[i] - 0.05f);
     }
     glEnd();
 
     // --- Draw Expanding Rings (Puddles) ---
 
     glLineWidth(2.0f);
-    for (const auto& splash : splashes) {
+    for (int s = 0; s < view.splashes.count; ++s) {
+        const Splash& splash = view.splashes.items[s];
         float alpha = splash.life * 0.8f;
         glColor4f(0.9f, 1.0f, 1.0f, alpha);
 
@@ -997,7 +2359,8 @@ void drawRainAndSplashes() {
     // --- Draw Vertical Splashes ---
     glPointSize(2.0f);
     glBegin(GL_POINTS);
-    for (const auto& droplet : droplets) {
+    for (int d = 0; d < view.droplets.count; ++d) {
+        const Droplet& droplet = view.droplets.items[d];
         float alpha = droplet.life * 1.5f;
         if (alpha > 1.0f) alpha = 1.0f;
         glColor4f(0.9f, 1.0f, 1.0f, alpha);
@@ -1106,17 +2469,10 @@ void drawMushroom(float x, float y, float scale) {
     setSceneElementColor(0.8f, 0.8f, 0.7f);
     glRectf(-0.01f, -0.05f, 0.01f, 0.0f);
 
-    // Cap
+    // Cap; the night glow is queued in world space and flushed with the layer
     if (getTimeMoment() == NIGHT) {
-        glPushAttrib(GL_ENABLE_BIT);
-        glDisable(GL_LIGHTING);
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-        glColor4f(0.6f, 0.9f, 1.0f, 0.8f);
-        drawCircle(0.0f, 0.0f, 0.03f, 0.5f);
-        glColor4f(0.8f, 1.0f, 1.0f, 0.3f);
-        drawCircle(0.0f, 0.0f, 0.05f, 0.5f);
-        glPopAttrib();
+        submitCircle(BLEND_ADDITIVE, x, y, 0.03f * scale, 0.5f, 0.6f, 0.9f, 1.0f, 0.8f);
+        submitCircle(BLEND_ADDITIVE, x, y, 0.05f * scale, 0.5f, 0.8f, 1.0f, 1.0f, 0.3f);
     } else {
         setSceneElementColor(0.9f, 0.2f, 0.2f);
         drawCircle(0.0f, 0.0f, 0.03f, 0.5f);
@@ -1137,17 +2493,10 @@ void drawLantern(float x, float y) {
     setSceneElementColor(0.6f, 0.5f, 0.2f);
     glRectf(x + 0.04f, y - 0.02f, x + 0.06f, y - 0.08f);
 
-    // Light
+    // Light, queued and flushed with the layer
     if (getTimeMoment() == NIGHT) {
-        glPushAttrib(GL_ENABLE_BIT);
-        glDisable(GL_LIGHTING);
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-        glColor4f(1.0f, 0.9f, 0.5f, 1.0f);
-        drawCircle(x + 0.05f, y - 0.05f, 0.02f);
-        glColor4f(1.0f, 0.9f, 0.5f, 0.3f);
-        drawCircle(x + 0.05f, y - 0.05f, 0.08f);
-        glPopAttrib();
+        submitCircle(BLEND_ADDITIVE, x + 0.05f, y - 0.05f, 0.02f, 1.0f, 1.0f, 0.9f, 0.5f, 1.0f);
+        submitCircle(BLEND_ADDITIVE, x + 0.05f, y - 0.05f, 0.08f, 1.0f, 1.0f, 0.9f, 0.5f, 0.3f);
     } else {
         glColor3f(1.0f, 1.0f, 0.8f);
         drawCircle(x + 0.05f, y - 0.05f, 0.02f);
@@ -1440,68 +2789,47 @@ void drawArcheryTrainingGround(float x, float y) {
 }
 
 
-void drawVillageDetails() {
+// Draws every prop of one type. Each prop's tint applies to all of its
+// scene-tinted colours, except for flowers whose tint is the petal colour.
+void drawPropGroup(PropType type) {
+    for (int i = propGroupStart[type]; i < propGroupStart[type + 1]; ++i) {
+        const SceneProp& p = sceneProps[i];
+        propTint = type == PROP_FLOWER ? NO_PROP_TINT : p.tint;
+        switch (type) {
+            case PROP_BUSH:            drawBush(p.x, p.y, p.sx); break;
+            case PROP_MUSHROOM:        drawMushroom(p.x, p.y, p.sx); break;
+            case PROP_VEGETABLE_FIELD: drawVegetableField(p.x, p.y, p.sx, p.sy); break;
+            case PROP_FIELD_TREE:      drawUpdatedSimpleTree(p.x, p.y, p.sx); break;
+            case PROP_ARCHERY_GROUND:  drawArcheryTrainingGround(p.x, p.y); break;
+            case PROP_WISHING_WELL:    drawWishingWell(p.x, p.y); break;
+            case PROP_FRONT_TREE:      drawSimpleTree(p.x, p.y, p.sx); break;
+            case PROP_LANTERN:         drawLantern(p.x, p.y); break;
+            case PROP_FENCE:           drawFence(p.x, p.y, p.param); break;
+            case PROP_HOUSE:           drawHouse(p.x, p.y, p.sx); break;
+            case PROP_FLOWER:          drawFlower(p.x, p.y, p.tint, p.sx); break;
+            default: break;
+        }
+    }
+    propTint = NO_PROP_TINT;
+}
 
-    drawMushroom(-0.6f, -0.7f, 1.0f);
-    drawMushroom(0.78f, -0.68f, 0.8f);
-    drawMushroom(0.84f, -0.69f, 0.7f);
-    drawMushroom(-2.41f, -0.3f, 0.7f);
-    drawMushroom(-2.43f, -0.22f, 0.7f);
-    drawMushroom(2.3f, -0.22f, 0.7f);
-    drawMushroom(2.4f, -0.22f, 0.7f);
-    drawMushroom(2.35f, -0.18f, 0.7f);
-    drawMushroom(0.45f, -0.45f, 0.7f);
-    drawMushroom(0.37f, -0.42f, 0.7f);
-    drawMushroom(0.43f, -0.39f, 0.7f);
-    drawMushroom(-0.68f, -0.7f, 0.9f);
-    drawMushroom(-0.7f, -0.45f, 0.75f);
-    drawMushroom(-0.77f, -0.45f, 0.75f);
-    drawMushroom(1.5f, -0.45f, 0.7f);
-    drawMushroom(1.56f, -0.42f, 0.7f);
-    drawMushroom(1.6f, -0.47f, 0.7f);
+// Draws the prop groups compiled into a static layer.
+void drawSceneProps(StaticLayer layer) {
+    for (int type = 0; type < PROP_TYPE_COUNT; ++type) {
+        if (propTypeLayer[type] == layer) drawPropGroup(static_cast<PropType>(type));
+    }
+}
 
+void drawFlowers() {
+    drawPropGroup(PROP_FLOWER);
+}
 
+void drawVillageDetails() {
+    drawStaticLayer(LAYER_MUSHROOMS);
     drawSnowCover();
-
-    drawVegetableField(-1.8f, -0.31f, 0.9f, 0.2f);
-    drawVegetableField(-0.8f, -0.31f, 0.9f, 0.2f);
-
-    drawUpdatedSimpleTree(-2.0f, -0.14f, 0.53f);
-    drawUpdatedSimpleTree(-2.3f, -0.14f, 0.6f);
-    drawUpdatedSimpleTree(-1.7f, -0.14f, 0.55f);
-    drawUpdatedSimpleTree(-1.4f, -0.14f, 0.52f);
-    drawUpdatedSimpleTree(-1.1f, -0.14f, 0.55f);
-    drawUpdatedSimpleTree(-0.78f, -0.14f, 0.6f);
-    drawUpdatedSimpleTree(1.7f, -0.13f, 0.56f);
-    drawUpdatedSimpleTree(0.8f, -0.12f, 0.55f);
-    drawUpdatedSimpleTree(1.1f, -0.12f, 0.56f);
-    drawUpdatedSimpleTree(1.4f, -0.12f, 0.57f);
-    drawUpdatedSimpleTree(2.0f, -0.13f, 0.56f);
-    drawUpdatedSimpleTree(2.3f, -0.13f, 0.55f);
-    drawUpdatedSimpleTree(2.6f, -0.13f, 0.56f);
-
-    drawArcheryTrainingGround(1.0f, -0.13f);
+    drawStaticLayer(LAYER_FIELDS_AND_TREES);
     drawPuddles();
-    drawWishingWell(1.8f, -0.2f);
-
-
-    drawSimpleTree(-2.2f, -0.5f, 1.5f);
-    drawSimpleTree(1.25f, -0.5f, 1.7f);
-    drawSimpleTree(2.2f, -0.48f, 1.5f);
-
-
-
-
-    // --- Draw lanterns ---
-    drawLantern(1.75f, -0.55f);
-    drawLantern(0.7f, -0.55f);
-
-    drawLantern(-2.3f, -0.55f);
-    drawLantern(-1.3f, -0.55f);
-
-    // --- Draw a fence section ---
-    drawFence(1.2f, -0.7f, 5);
-
+    drawStaticLayer(LAYER_VILLAGE_PROPS);
 }
 
 void drawGroundPatches() {
@@ -1533,29 +2861,41 @@ void drawForegroundRiver() {
     float ice_r = 0.9f, ice_g = 0.95f, ice_b = 1.0f;
 
 
-    float r = water_r + (ice_r - water_r) * riverFreezeAmount;
-    float g = water_g + (ice_g - water_g) * riverFreezeAmount;
-    float b = water_b + (ice_b - water_b) * riverFreezeAmount;
+    float r = water_r + (ice_r - water_r) * view.riverFreezeAmount;
+    float g = water_g + (ice_g - water_g) * view.riverFreezeAmount;
+    float b = water_b + (ice_b - water_b) * view.riverFreezeAmount;
 
     // ---  Draw the Main River Body ---
     setSceneElementColor(r, g, b);
     glRectf(-2.5f, river_top_y, 2.5f, river_bottom_y);
 
     // ---  Draw Animated Waves (which fade when frozen) ---
-    float waveAlpha = 0.6f * (1.0f - riverFreezeAmount);
+    float waveAlpha = 0.6f * (1.0f - view.riverFreezeAmount);
 
     if (waveAlpha > 0.01f) {
         glEnable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
         glLineWidth(2.0f);
-        glColor4f(0.6f, 0.85f, 1.0f, waveAlpha);
-        glBegin(GL_LINE_STRIP);
-        for (int i = 0; i <= 100; ++i) {
-            float x = -2.5f + (i / 100.0f) * 5.0f;
-            float waveY = river_top_y + 0.02f * sinf(x * 3.0f + riverFlowOffset * 1.5f) + 0.01f * cosf(x * 1.5f + riverFlowOffset);
-            glVertex2f(x, waveY + 0.005f);
+        if (riverEffect.program) {
+            useEffect(riverEffect.program);
+            uniform1f(riverEffect.flowOffset, view.riverFlowOffset);
+            uniform1f(riverEffect.freezeAmount, view.riverFreezeAmount);
+            uniform1f(riverEffect.riverTop, river_top_y);
+            glEnableClientState(GL_VERTEX_ARRAY);
+            glVertexPointer(2, GL_FLOAT, 0, riverWaveXY);
+            glDrawArrays(GL_LINE_STRIP, 0, RIVER_WAVE_SEGMENTS + 1);
+            glDisableClientState(GL_VERTEX_ARRAY);
+            useEffect(0);
+        } else {
+            glColor4f(0.6f, 0.85f, 1.0f, waveAlpha);
+            glBegin(GL_LINE_STRIP);
+            for (int i = 0; i <= RIVER_WAVE_SEGMENTS; ++i) {
+                float x = -2.5f + (i / (float)RIVER_WAVE_SEGMENTS) * 5.0f;
+                float waveY = river_top_y + 0.02f * sinf(x * 3.0f + view.riverFlowOffset * 1.5f) + 0.01f * cosf(x * 1.5f + view.riverFlowOffset);
+                glVertex2f(x, waveY + 0.005f);
+            }
+            glEnd();
         }
-        glEnd();
         glLineWidth(1.0f);
         glDisable(GL_BLEND);
     }
@@ -1584,7 +2924,7 @@ void drawTreeHouse(float x, float y) {
 
 
 
-void drawGreatTree() {
+void drawGreatTreeBody() {
     float y_offset = -0.1f;
 
     // --- 1. Trunk and Main Branches ---
@@ -1653,19 +2993,10 @@ void drawGreatTree() {
         glVertex2f(0.3f, 0.1f + y_offset); glVertex2f(0.5f, 0.0f + y_offset);
     glEnd();
     glLineWidth(1.0f);
+}
 
-    // --- Hanging Moss and Lanterns ---
-    drawHangingMoss(-0.5f, 0.2f + y_offset, 1.0f);
-    drawHangingMoss(0.1f, 0.5f + y_offset, 0.8f);
-    drawHangingMoss(0.45f, 0.25f + y_offset, 1.2f);
-    drawHangingMoss(-0.0f, -0.2f + y_offset, 0.8f);
-    drawHangingMoss(-0.3f, 0.7f + y_offset, 0.9f);
-    drawHangingMoss(0.3f, 0.7f + y_offset, 0.9f);
-
-    drawHangingLantern(-0.5f, 0.4f + y_offset);
-    drawHangingLantern(0.5f, 0.4f + y_offset);
-    drawHangingLantern(-0.3f, 0.0f + y_offset);
-    drawHangingLantern(0.3f, 0.0f + y_offset);
+void drawGreatTreeHouses() {
+    float y_offset = -0.1f;
 
     // --- Tree Houses ---
     drawTreeHouse(-0.4f, 0.45f + y_offset);
@@ -1690,13 +3021,35 @@ void drawGreatTree() {
     }
 }
 
+void drawGreatTree() {
+    float y_offset = -0.1f;
+
+    drawStaticLayer(LAYER_GREAT_TREE);
+
+    // --- Hanging Moss and Lanterns ---
+    drawHangingMoss(-0.5f, 0.2f + y_offset, 1.0f);
+    drawHangingMoss(0.1f, 0.5f + y_offset, 0.8f);
+    drawHangingMoss(0.45f, 0.25f + y_offset, 1.2f);
+    drawHangingMoss(-0.0f, -0.2f + y_offset, 0.8f);
+    drawHangingMoss(-0.3f, 0.7f + y_offset, 0.9f);
+    drawHangingMoss(0.3f, 0.7f + y_offset, 0.9f);
+
+    drawHangingLantern(-0.5f, 0.4f + y_offset);
+    drawHangingLantern(0.5f, 0.4f + y_offset);
+    drawHangingLantern(-0.3f, 0.0f + y_offset);
+    drawHangingLantern(0.3f, 0.0f + y_offset);
+    flushRenderQueue();
+
+    drawStaticLayer(LAYER_TREE_HOUSES);
+}
+
 void drawPuddles() {
-    if (puddles.empty()) return;
+    if (view.puddles.empty()) return;
 
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    for (const auto& p : puddles) {
+    for (const auto& p : view.puddles) {
         // Water and Frozen colors
         float water_r = 0.15f, water_g = 0.3f, water_b = 0.5f;
         float frozen_r = 0.8f, frozen_g = 0.9f, frozen_b = 1.0f;
@@ -1709,16 +3062,17 @@ void drawPuddles() {
         // Frozen puddles are less transparent
         float alpha = 0.6f + 0.2f * p.freezeProgress;
 
-        glColor4f(r, g, b, alpha);
-        drawCircle(p.x, p.y, p.currentRadius, 0.4f);
+        submitCircle(BLEND_ALPHA, p.x, p.y, p.currentRadius, PUDDLE_Y_SCALE, r, g, b, alpha);
+    }
+    flushRenderQueue();
 
-        //  a frosty edge when it's freezing/frozen
+    //  a frosty edge when it's freezing/frozen
+    for (const auto& p : view.puddles) {
         if (p.freezeProgress > 0.1f) {
             glColor4f(1.0f, 1.0f, 1.0f, 0.5f * p.freezeProgress);
             glBegin(GL_LINE_LOOP);
-            for(int i=0; i<30; ++i) {
-                float angle = i * 2.0f * PI / 30.0f;
-                glVertex2f(p.x + cosf(angle) * p.currentRadius, p.y + sinf(angle) * p.currentRadius * 0.4f);
+            for(int i=0; i<CIRCLE_SEGMENTS; ++i) {
+                glVertex2f(p.x + unitCircleCos[i] * p.currentRadius, p.y + unitCircleSin[i] * p.currentRadius * PUDDLE_Y_SCALE);
             }
             glEnd();
         }
@@ -1730,240 +3084,211 @@ void drawPuddles() {
 void drawSnow() {
     if (currentWeather != SNOWY) return;
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
     // Snowflakes are white and semi-transparent
-    glColor4f(1.0f, 1.0f, 1.0f, 0.8f);
-
-    for (int i = 0; i < SNOW_COUNT; ++i) {
-        drawCircle(snowflakes[i].x, snowflakes[i].y, snowflakes[i].size);
+    for (int i = 0; i < view.snowCount; ++i) {
+        submitCircle(BLEND_ALPHA, view.snowX[i], view.snowY[i], view.snowSize[i], 1.0f,
+                     1.0f, 1.0f, 1.0f, 0.8f);
     }
-
-    glDisable(GL_BLEND);
+    flushRenderQueue();
 }
 
+// The glow, rays and body are queued in three layers so the glow stays under
+// the body and the base shards stay on top, as when they were drawn directly.
 void drawCrystal(float x, float y) {
     // --- Magical Glow and Effects (ONLY AT NIGHT) ---
     if (getTimeMoment() == NIGHT) {
-        glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT);
-        glDisable(GL_LIGHTING);
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE); // Additive blending for glows
-
         //  The Volumetric Glow and Aura
-        float auraPulse = 0.6f + 0.4f * sinf(crystalGlow * 0.7f);
-        float aura_r = 0.4f + 0.1f * sinf(crystalGlow * 0.5f);
-        float aura_g = 0.7f + 0.1f * sinf(crystalGlow * 0.6f + PI / 2);
-        float aura_b = 0.9f + 0.1f * sinf(crystalGlow * 0.4f + PI);
-        glColor4f(aura_r, aura_g, aura_b, 0.06f * auraPulse);
-        drawCircle(x, y, 0.35f, 1.3f);
-
-        float midPulse = 0.7f + 0.3f * sinf(crystalGlow * 1.2f + PI / 4);
-        float mid_r = 0.5f + 0.2f * sinf(crystalGlow * 0.8f);
-        float mid_g = 0.8f + 0.2f * sinf(crystalGlow * 0.9f + PI / 3);
-        float mid_b = 1.0f;
-        glColor4f(mid_r, mid_g, mid_b, 0.12f * midPulse);
-        drawCircle(x, y, 0.22f, 1.2f);
-
-        float corePulse = 0.8f + 0.2f * sinf(crystalGlow * 1.8f);
-        float core_r = 0.7f + 0.3f * sinf(crystalGlow * 1.5f);
-        float core_g = 0.9f + 0.1f * sinf(crystalGlow * 1.6f + PI / 6);
-        float core_b = 1.0f;
-        glColor4f(core_r, core_g, core_b, 0.25f * corePulse);
-        drawCircle(x, y, 0.15f, 1.1f);
-
-        // Animated Light Rays
-        glPushMatrix();
-        glTranslatef(x, y, 0.0f);
-        glRotatef(crystalGlow * 25.0f, 0, 0, 1);
-        glLineWidth(2.0f);
+        float corePulse = 0.8f + 0.2f * sinf(view.crystalGlow * 1.8f);
+        if (crystalEffect.program) {
+            glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT);
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE); // Additive blending for glows
+            useEffect(crystalEffect.program);
+            uniform1f(crystalEffect.glow, view.crystalGlow);
+            uniform2f(crystalEffect.center, x, y);
+            glRectf(x - 0.35f, y - 0.35f * 1.3f, x + 0.35f, y + 0.35f * 1.3f);
+            useEffect(0);
+            glPopAttrib();
+        } else {
+            float auraPulse = 0.6f + 0.4f * sinf(view.crystalGlow * 0.7f);
+            float aura_r = 0.4f + 0.1f * sinf(view.crystalGlow * 0.5f);
+            float aura_g = 0.7f + 0.1f * sinf(view.crystalGlow * 0.6f + PI / 2);
+            float aura_b = 0.9f + 0.1f * sinf(view.crystalGlow * 0.4f + PI);
+            submitCircle(BLEND_ADDITIVE, x, y, 0.35f, 1.3f, aura_r, aura_g, aura_b, 0.06f * auraPulse);
+
+            float midPulse = 0.7f + 0.3f * sinf(view.crystalGlow * 1.2f + PI / 4);
+            float mid_r = 0.5f + 0.2f * sinf(view.crystalGlow * 0.8f);
+            float mid_g = 0.8f + 0.2f * sinf(view.crystalGlow * 0.9f + PI / 3);
+            float mid_b = 1.0f;
+            submitCircle(BLEND_ADDITIVE, x, y, 0.22f, 1.2f, mid_r, mid_g, mid_b, 0.12f * midPulse);
+
+            float core_r = 0.7f + 0.3f * sinf(view.crystalGlow * 1.5f);
+            float core_g = 0.9f + 0.1f * sinf(view.crystalGlow * 1.6f + PI / 6);
+            float core_b = 1.0f;
+            submitCircle(BLEND_ADDITIVE, x, y, 0.15f, 1.1f, core_r, core_g, core_b, 0.25f * corePulse);
+        }
+
+        // Animated Light Rays, rotated around the crystal
+        float spin = view.crystalGlow * 25.0f * (PI / 180.0f);
+        float spinCos = cosf(spin), spinSin = sinf(spin);
+        queueColor(0.8f, 0.95f, 1.0f, 0.2f * corePulse);
+        queueBegin(0, BLEND_ADDITIVE, GL_LINES, 2.0f);
         for (int i = 0; i < 6; ++i) {
             float angle = i * 60.0f * (PI / 180.0f);
-            float length = 0.15f + 0.04f * sinf(crystalGlow * 1.2f + i * 0.5f);
-            glColor4f(0.8f, 0.95f, 1.0f, 0.2f * corePulse);
-            glBegin(GL_LINES);
-                glVertex2f(0,0);
-                glVertex2f(cosf(angle) * length, sinf(angle) * length * 2.0f);
-            glEnd();
+            float length = 0.15f + 0.04f * sinf(view.crystalGlow * 1.2f + i * 0.5f);
+            float rayX = cosf(angle) * length, rayY = sinf(angle) * length * 2.0f;
+            queueVertex(x, y);
+            queueVertex(x + rayX * spinCos - rayY * spinSin, y + rayX * spinSin + rayY * spinCos);
         }
-        glLineWidth(1.0f);
-        glPopMatrix();
-
-
-        glPopAttrib();
+        queueEnd();
     }
 
 
     // ---  The Physical Crystal (Always visible) ---
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    glBegin(GL_POLYGON);
+    queueBegin(1, BLEND_ALPHA, GL_POLYGON);
         float color_top_r = 0.3f, color_top_g = 0.6f, color_top_b = 0.9f;
         float color_bottom_r = 0.5f, color_bottom_g = 0.2f, color_bottom_b = 0.7f;
-        setSceneElementColor(color_top_r, color_top_g, color_top_b);
-        glVertex2f(x, y + 0.15f);
-        setSceneElementColor(0.4f, 0.5f, 0.8f);
-        glVertex2f(x + 0.08f, y + 0.05f);
-        setSceneElementColor(color_bottom_r, color_bottom_g, color_bottom_b);
-        glVertex2f(x + 0.05f, y - 0.12f);
-        glVertex2f(x - 0.05f, y - 0.12f);
-        setSceneElementColor(0.4f, 0.5f, 0.8f);
-        glVertex2f(x - 0.08f, y + 0.05f);
-    glEnd();
+        queueSceneColor(color_top_r, color_top_g, color_top_b);
+        queueVertex(x, y + 0.15f);
+        queueSceneColor(0.4f, 0.5f, 0.8f);
+        queueVertex(x + 0.08f, y + 0.05f);
+        queueSceneColor(color_bottom_r, color_bottom_g, color_bottom_b);
+        queueVertex(x + 0.05f, y - 0.12f);
+        queueVertex(x - 0.05f, y - 0.12f);
+        queueSceneColor(0.4f, 0.5f, 0.8f);
+        queueVertex(x - 0.08f, y + 0.05f);
+    queueEnd();
 
     // Internal reflections
-    glColor4f(1.0f, 1.0f, 1.0f, 0.6f);
-    glBegin(GL_POLYGON);
-        glVertex2f(x, y + 0.12f);
-        glVertex2f(x + 0.02f, y + 0.08f);
-        glVertex2f(x + 0.01f, y - 0.08f);
-        glVertex2f(x - 0.01f, y - 0.08f);
-        glVertex2f(x - 0.02f, y + 0.08f);
-    glEnd();
-
-    glDisable(GL_BLEND);
+    queueColor(1.0f, 1.0f, 1.0f, 0.6f);
+    queueBegin(1, BLEND_ALPHA, GL_POLYGON);
+        queueVertex(x, y + 0.12f);
+        queueVertex(x + 0.02f, y + 0.08f);
+        queueVertex(x + 0.01f, y - 0.08f);
+        queueVertex(x - 0.01f, y - 0.08f);
+        queueVertex(x - 0.02f, y + 0.08f);
+    queueEnd();
 
     // Crystal Shards at the Base
-    glBegin(GL_TRIANGLES);
-        setSceneElementColor(0.4f, 0.5f, 0.8f); glVertex2f(x - 0.04f, y - 0.1f);
-        setSceneElementColor(0.3f, 0.4f, 0.6f); glVertex2f(x - 0.12f, y - 0.15f);
-        setSceneElementColor(0.4f, 0.5f, 0.8f); glVertex2f(x - 0.08f, y - 0.08f);
+    queueBegin(2, BLEND_OPAQUE, GL_TRIANGLES);
+        queueSceneColor(0.4f, 0.5f, 0.8f); queueVertex(x - 0.04f, y - 0.1f);
+        queueSceneColor(0.3f, 0.4f, 0.6f); queueVertex(x - 0.12f, y - 0.15f);
+        queueSceneColor(0.4f, 0.5f, 0.8f); queueVertex(x - 0.08f, y - 0.08f);
 
-        setSceneElementColor(0.4f, 0.5f, 0.8f); glVertex2f(x + 0.04f, y - 0.1f);
-        setSceneElementColor(0.3f, 0.4f, 0.6f); glVertex2f(x + 0.12f, y - 0.15f);
-        setSceneElementColor(0.4f, 0.5f, 0.8f); glVertex2f(x + 0.08f, y - 0.08f);
-    glEnd();
+        queueSceneColor(0.4f, 0.5f, 0.8f); queueVertex(x + 0.04f, y - 0.1f);
+        queueSceneColor(0.3f, 0.4f, 0.6f); queueVertex(x + 0.12f, y - 0.15f);
+        queueSceneColor(0.4f, 0.5f, 0.8f); queueVertex(x + 0.08f, y - 0.08f);
+    queueEnd();
+
+    flushRenderQueue();
+}
+
+void drawLeafPose(SpriteLayer layer) {
+    spriteInstanceColor(layer);
+    glBegin(GL_QUADS); glVertex2f(0,1); glVertex2f(-0.5,0); glVertex2f(0,-1); glVertex2f(0.5,0); glEnd();
 }
 
 void drawLeaves() {
     if (currentWeather == SNOWY) return;
 
-    glEnable(GL_BLEND);
     for (int i = 0; i < LEAF_COUNT; ++i) {
-        setSceneElementColor(leaves[i].r, leaves[i].g, leaves[i].b, 0.85f);
-        glPushMatrix();
-        glTranslatef(leaves[i].x, leaves[i].y, 0.0f); glRotatef(leaves[i].rotation, 0,0,1);
-        glScalef(leaves[i].size * 0.015f, leaves[i].size * 0.015f, 1.0f);
-        glBegin(GL_QUADS); glVertex2f(0,1); glVertex2f(-0.5,0); glVertex2f(0,-1); glVertex2f(0.5,0); glEnd();
-        glPopMatrix();
+        float scale = view.leaves.size[i] * 0.015f;
+        SpriteInstance instance = {view.leaves.x[i], view.leaves.y[i], view.leaves.rotation[i] * (PI / 180.0f), scale, scale,
+                                   tinted(view.leaves.r[i], 0), tinted(view.leaves.g[i], 1), tinted(view.leaves.b[i], 2), 0.85f};
+        submitSprite(SPRITE_LEAF, 0, instance);
     }
-    glDisable(GL_BLEND);
+    flushSprites();
 }
 
-void drawElves() {
-    for(int i = 0; i < ELF_COUNT; ++i) {
-        glPushMatrix();
-        glTranslatef(elves[i].x, elves[i].y, 0.0f);
-
-        // Flip direction based on movement
-        if (elves[i].x < elves[i].targetX) {
-            glScalef(1.0f, 1.0f, 1.0f);
-        } else {
-            glScalef(-1.0f, 1.0f, 1.0f);
-        }
-
-        // Animation calculations
-        float legAngle = 0.0f;
-        float armAngle = 0.0f;
-        if (elves[i].state == ELF_WALKING) {
-            legAngle = 20.0f * sinf(elves[i].animationPhase);
-            armAngle = 15.0f * sinf(elves[i].animationPhase);
-        }
+void drawElfPose(float phase, SpriteLayer layer) {
+    // Animation calculations; phase 0 is also the idle pose
+    float legAngle = 20.0f * sinf(phase);
+    float armAngle = 15.0f * sinf(phase);
+
+    // --- Draw Legs ---
+    spritePartColor(layer, 0.2f, 0.15f, 0.1f); // Dark pants
+    glPushMatrix(); // Leg 1
+        glTranslatef(-0.01f, -0.04f, 0.0f);
+        glRotatef(legAngle, 1, 0, 0);
+        glRectf(-0.005f, 0, 0.005f, -0.04f);
+    glPopMatrix();
+    glPushMatrix(); // Leg 2
+        glTranslatef(0.01f, -0.04f, 0.0f);
+        glRotatef(-legAngle, 1, 0, 0);
+        glRectf(-0.005f, 0, 0.005f, -0.04f);
+    glPopMatrix();
 
-        // --- Draw Legs ---
-        setSceneElementColor(0.2f, 0.15f, 0.1f); // Dark pants
-        glPushMatrix(); // Leg 1
-            glTranslatef(-0.01f, -0.04f, 0.0f);
-            glRotatef(legAngle, 1, 0, 0);
-            glRectf(-0.005f, 0, 0.005f, -0.04f);
-        glPopMatrix();
-        glPushMatrix(); // Leg 2
-            glTranslatef(0.01f, -0.04f, 0.0f);
-            glRotatef(-legAngle, 1, 0, 0);
-            glRectf(-0.005f, 0, 0.005f, -0.04f);
-        glPopMatrix();
+    // --- Draw Arms ---
+    spritePartColor(layer, 0.95f, 0.85f, 0.75f); // Skin color
+    glPushMatrix(); // Arm 1 (back)
+        glTranslatef(-0.018f, -0.01f, 0.0f);
+        glRotatef(-armAngle, 1, 0, 0);
+        glRectf(-0.005f, 0, 0.005f, -0.035f);
+    glPopMatrix();
+    glPushMatrix(); // Arm 2 (front)
+        glTranslatef(0.018f, -0.01f, 0.0f);
+        glRotatef(armAngle, 1, 0, 0);
+        glRectf(-0.005f, 0, 0.005f, -0.035f);
+    glPopMatrix();
 
-        // --- Draw Arms ---
-        setSceneElementColor(0.95f, 0.85f, 0.75f); // Skin color
-        glPushMatrix(); // Arm 1 (back)
-            glTranslatef(-0.018f, -0.01f, 0.0f);
-            glRotatef(-armAngle, 1, 0, 0);
-            glRectf(-0.005f, 0, 0.005f, -0.035f);
-        glPopMatrix();
-        glPushMatrix(); // Arm 2 (front)
-            glTranslatef(0.018f, -0.01f, 0.0f);
-            glRotatef(armAngle, 1, 0, 0);
-            glRectf(-0.005f, 0, 0.005f, -0.035f);
-        glPopMatrix();
+    // --- Draw Torso ---
+    spriteInstanceColor(layer); // Tunic color
+    glRectf(-0.02f, -0.04f, 0.02f, 0.0f);
 
-        // --- Draw Torso ---
-        setSceneElementColor(elves[i].r, elves[i].g, elves[i].b); // Tunic color
-        glRectf(-0.02f, -0.04f, 0.02f, 0.0f);
+    // --- Draw Head ---
+    spritePartColor(layer, 0.95f, 0.85f, 0.75f); // Skin color
+    drawCircle(0, 0.015f, 0.015f);
 
-        // --- Draw Head ---
-        setSceneElementColor(0.95f, 0.85f, 0.75f); // Skin color
-        drawCircle(0, 0.015f, 0.015f);
+    // Pointy Ears
+    glBegin(GL_TRIANGLES);
+        glVertex2f(-0.01f, 0.025f); glVertex2f(-0.025f, 0.04f); glVertex2f(-0.015f, 0.045f);
+        glVertex2f(0.01f, 0.025f); glVertex2f(0.025f, 0.04f); glVertex2f(0.015f, 0.045f);
+    glEnd();
 
-        // Pointy Ears
-        glBegin(GL_TRIANGLES);
-            glVertex2f(-0.01f, 0.025f); glVertex2f(-0.025f, 0.04f); glVertex2f(-0.015f, 0.045f);
-            glVertex2f(0.01f, 0.025f); glVertex2f(0.025f, 0.04f); glVertex2f(0.015f, 0.045f);
-        glEnd();
+    // Hair
+    spritePartColor(layer, 0.9f, 0.9f, 0.3f); // Blonde hair
+    drawCircle(0, 0.025f, 0.016f);
+}
 
-        // Hair
-        setSceneElementColor(0.9f, 0.9f, 0.3f); // Blonde hair
-        drawCircle(0, 0.025f, 0.016f);
+void drawElves() {
+    for(int i = 0; i < ELF_COUNT; ++i) {
+        const Elf& elf = view.elves[i];
+        int frame = elf.state == ELF_WALKING ? spriteFrame(SPRITE_ELF, elf.animationPhase) : 0;
 
-        glPopMatrix();
+        // Flip direction based on movement
+        SpriteInstance instance = {interpolated(elf.prevX, elf.x, 1.0f), elf.y, 0.0f,
+                                   elf.x < elf.targetX ? 1.0f : -1.0f, 1.0f,
+                                   tinted(elf.r, 0), tinted(elf.g, 1), tinted(elf.b, 2), 1.0f};
+        submitSprite(SPRITE_ELF, frame, instance);
     }
+    flushSprites();
 }
 
-void drawFairyFox() {
-    //  Stop drawing the fox if it is raining
-    if (currentWeather == RAINY) {
-        return;
-    }
-
-    // --- Path and Position Calculation ---
-    float path_y = -0.95f;
-    float x = -3.5f + fox.progress * 7.0f;
-    float y = path_y + 0.04f;
-
-    glPushMatrix();
-    glTranslatef(x, y, 0.0f);
-
-    glScalef(0.65f, 0.65f, 1.0f);
-
-    // --- Leg Animation Calculation ---
-    float walkCycle = fox.progress * 150.0f;
-    float legOffset1 = 0.015f * sinf(walkCycle);
-    float legOffset2 = 0.015f * sinf(walkCycle + PI);
-
-    // --- 1. Draw the Tail FIRST ---
-    glPushMatrix();
-    glTranslatef(-0.12f, 0.06f, 0.0f);
-    glRotatef(sinf(fox.tailSway) * 20.0f, 0,0,1);
-
-    setSceneElementColor(0.8f, 0.45f, 0.15f);
+// The tail, in the fox's units about the point where it joins the body.
+void drawFoxTailPose(SpriteLayer layer) {
+    spritePartColor(layer, 0.8f, 0.45f, 0.15f);
     glPushMatrix();
     glTranslatef(-0.06f, 0.0f, 0.0f);
     glScalef(0.07f, 0.05f, 1.0f);
     drawCircle(0, 0, 1.0f);
     glPopMatrix();
 
-    setSceneElementColor(0.95f, 0.95f, 0.95f);
+    spritePartColor(layer, 0.95f, 0.95f, 0.95f);
     glPushMatrix();
     glTranslatef(-0.12f, 0.0f, 0.0f);
     glScalef(0.035f, 0.025f, 1.0f);
     drawCircle(0, 0, 1.0f);
     glPopMatrix();
+}
 
-    glPopMatrix();
+// Legs, body and head at one point of the walk cycle.
+void drawFoxBodyPose(float phase, SpriteLayer layer) {
+    // --- Leg Animation Calculation ---
+    float legOffset1 = 0.015f * sinf(phase);
+    float legOffset2 = 0.015f * sinf(phase + PI);
 
-    // --- 2. Draw Legs BEFORE the body ---
-    setSceneElementColor(0.5f, 0.25f, 0.05f);
+    // --- Draw Legs BEFORE the body ---
+    spritePartColor(layer, 0.5f, 0.25f, 0.05f);
     glBegin(GL_QUADS);
         glVertex2f(-0.03f, 0); glVertex2f(-0.01f, 0);
         glVertex2f(-0.01f, -0.08f + legOffset1); glVertex2f(-0.03f, -0.08f + legOffset1);
@@ -1971,7 +3296,7 @@ void drawFairyFox() {
         glVertex2f(0.10f, -0.08f + legOffset2); glVertex2f(0.08f, -0.08f + legOffset2);
     glEnd();
 
-    setSceneElementColor(0.6f, 0.35f, 0.1f);
+    spritePartColor(layer, 0.6f, 0.35f, 0.1f);
     glBegin(GL_QUADS);
         glVertex2f(-0.08f, 0); glVertex2f(-0.06f, 0);
         glVertex2f(-0.06f, -0.08f + legOffset2); glVertex2f(-0.08f, -0.08f + legOffset2);
@@ -1979,49 +3304,73 @@ void drawFairyFox() {
         glVertex2f(0.05f, -0.08f + legOffset1); glVertex2f(0.03f, -0.08f + legOffset1);
     glEnd();
 
-    // --- 3. Draw Body and Head LAST ---
-    setSceneElementColor(0.8f, 0.45f, 0.15f);
+    // --- Draw Body and Head LAST ---
+    spritePartColor(layer, 0.8f, 0.45f, 0.15f);
     glPushMatrix(); glTranslatef(0, 0.05f, 0.0f); glScalef(0.12f, 0.08f, 1.0f); drawCircle(0, 0, 1.0f); glPopMatrix();
 
-    setSceneElementColor(0.8f, 0.45f, 0.15f);
+    spritePartColor(layer, 0.8f, 0.45f, 0.15f);
     drawCircle(0.12f, 0.13f, 0.04f, 0.8f);
 
-    setSceneElementColor(0.2f, 0.1f, 0.0f); drawCircle(0.15f, 0.13f, 0.008f);
+    spritePartColor(layer, 0.2f, 0.1f, 0.0f); drawCircle(0.15f, 0.13f, 0.008f);
 
-    setSceneElementColor(0.1f, 0.1f, 0.1f);
+    spritePartColor(layer, 0.1f, 0.1f, 0.1f);
     drawCircle(0.13f, 0.145f, 0.005f);
 
-    setSceneElementColor(0.8f, 0.45f, 0.15f);
+    spritePartColor(layer, 0.8f, 0.45f, 0.15f);
     glBegin(GL_TRIANGLES);
         glVertex2f(0.10f, 0.17f); glVertex2f(0.13f, 0.17f); glVertex2f(0.115f, 0.20f);
     glEnd();
 
-    setSceneElementColor(0.95f, 0.95f, 0.95f);
+    spritePartColor(layer, 0.95f, 0.95f, 0.95f);
     glBegin(GL_TRIANGLES);
         glVertex2f(0.11f, 0.17f); glVertex2f(0.125f, 0.17f); glVertex2f(0.118f, 0.19f);
     glEnd();
+}
 
-    glPopMatrix();
+void drawFairyFox() {
+    //  Stop drawing the fox if it is raining
+    if (currentWeather == RAINY) {
+        return;
+    }
+
+    // --- Path and Position Calculation ---
+    const float scale = 0.65f;
+    float path_y = -0.95f;
+    double tick = renderTick();
+    float progress = foxProgressAt(view.fox, tick);
+    float x = -3.5f + progress * 7.0f;
+    float y = path_y + 0.04f;
+
+    // --- 1. Draw the Tail FIRST ---
+    SpriteInstance tail = {x - 0.12f * scale, y + 0.06f * scale, sinf(foxTailSwayAt(view.fox, tick)) * 20.0f * (PI / 180.0f),
+                           scale, scale, 1.0f, 1.0f, 1.0f, 1.0f};
+    submitSprite(SPRITE_FOX_TAIL, 0, tail);
+
+    // --- 2. Then the legs, body and head ---
+    float walkCycle = progress * 150.0f;
+    SpriteInstance body = {x, y, 0.0f, scale, scale, 1.0f, 1.0f, 1.0f, 1.0f};
+    submitSprite(SPRITE_FOX_BODY, spriteFrame(SPRITE_FOX_BODY, walkCycle), body);
+    flushSprites();
 }
 
 
 void drawSnowCover() {
 
-    if (snowCoverage <= 0.0f) return;
+    if (view.snowCoverage <= 0.0f) return;
 
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     // Use a slightly blueish-white for the snow, with transparency based on coverage
-    glColor4f(0.95f, 0.95f, 1.0f, snowCoverage * 0.9f);
+    glColor4f(0.95f, 0.95f, 1.0f, view.snowCoverage * 0.9f);
 
     // --- Draw a large rectangle to cover the entire ground area ---
 
     glRectf(-2.5f, -0.1f, 2.5f, -1.1f);
 
     // Add a few extra circles to make the snow drifts look more natural and less flat
-     if (snowCoverage > 0.5f) {
-        glColor4f(0.95f, 0.95f, 1.0f, (snowCoverage - 0.5f) * 0.5f);
+     if (view.snowCoverage > 0.5f) {
+        glColor4f(0.95f, 0.95f, 1.0f, (view.snowCoverage - 0.5f) * 0.5f);
         drawCircle(-1.5f, -0.7f, 0.5f, 0.4f);
         drawCircle(0.0f, -0.8f, 0.7f, 0.4f);
         drawCircle(1.8f, -0.75f, 0.6f, 0.5f);
@@ -2031,313 +3380,1433 @@ void drawSnowCover() {
 }
 
 
+void drawBirdPose(float phase, SpriteLayer layer) {
+    float wingAngle = 0.02f * sinf(phase);
+    spritePartColor(layer, 0.1f, 0.1f, 0.1f, false);
+    glLineWidth(2.0f);
+    glBegin(GL_LINE_STRIP);
+      glVertex2f(-0.02f, wingAngle);
+      glVertex2f(0.0f, 0.0f);
+      glVertex2f(0.02f, wingAngle);
+    glEnd();
+    glLineWidth(1.0f);
+}
+
 void drawBirds() {
     TimeMoment tm = getTimeMoment();
     if (tm == NIGHT || currentWeather == RAINY || currentWeather == SNOWY) {
         return;
     }
 
-    glColor3f(0.1f, 0.1f, 0.1f);
-    glLineWidth(2.0f);
-
+    double tick = renderTick();
     for (int i = 0; i < MAX_BIRDS; i++) {
-        float wingAngle = 0.02f * sinf(birds[i].phase);
-
-        glBegin(GL_LINE_STRIP);
-          glVertex2f(birds[i].x - 0.02f, birds[i].y + wingAngle);
-          glVertex2f(birds[i].x, birds[i].y);
-          glVertex2f(birds[i].x + 0.02f, birds[i].y + wingAngle);
-        glEnd();
+        const Bird& bird = view.birds[i];
+        SpriteInstance instance = {birdXAt(bird, tick), bird.y, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f};
+        submitSprite(SPRITE_BIRD, spriteFrame(SPRITE_BIRD, birdPhaseAt(bird, tick)), instance);
     }
-    glLineWidth(1.0f);
+    flushSprites();
 }
 
-// --- Initialization Functions ---
+// --- Random Numbers ---
+// Every subsystem draws from its own xoshiro128+ stream, so subsystems never
+// disturb each other's sequences and can be updated from separate threads.
+// All streams derive from one 64-bit scene seed via splitmix64; pass
+// --seed N on the command line to reproduce a run.
 
-void initRain() {
-    for (int i = 0; i < RAIN_COUNT; ++i) {
-        raindrops[i].x = -2.5f + (rand() / (float)RAND_MAX) * 5.0f;
-        raindrops[i].y = 1.5f + (rand() / (float)RAND_MAX) * 2.0f;
-        raindrops[i].speed = 0.02f + (rand() / (float)RAND_MAX) * 0.02f;
+enum RandomStream {
+    RNG_LEAVES, RNG_ELVES, RNG_STARS, RNG_CLOUDS, RNG_BIRDS, RNG_RAIN, RNG_SPLASHES,
+    RNG_BUTTERFLIES, RNG_FIREFLIES, RNG_SNOW, RNG_PUDDLES, RNG_PARTICLES, RANDOM_STREAM_COUNT
+};
+
+struct RandomState {
+    uint32_t s[4];
+};
+
+RandomState randomStreams[RANDOM_STREAM_COUNT];
+uint64_t sceneSeed = 0;
+bool sceneSeedFixed = false;
+
+uint64_t splitMix64(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+void seedRandomStreams(uint64_t seed) {
+    uint64_t state = seed;
+    for (int i = 0; i < RANDOM_STREAM_COUNT; ++i) {
+        uint64_t a = splitMix64(state);
+        uint64_t b = splitMix64(state);
+        RandomState& r = randomStreams[i];
+        r.s[0] = (uint32_t)a; r.s[1] = (uint32_t)(a >> 32);
+        r.s[2] = (uint32_t)b; r.s[3] = (uint32_t)(b >> 32);
+        if ((r.s[0] | r.s[1] | r.s[2] | r.s[3]) == 0) r.s[0] = 1u;
     }
 }
-void initButterflies() {
-    for (int i = 0; i < 7; ++i) { // Create 7 butterflies
-        Butterfly b;
-        b.x = -2.0f + (rand() / (float)RAND_MAX) * 4.0f;
-        b.y = -0.8f + (rand() / (float)RAND_MAX) * 0.4f;
-        b.initialY = b.y;
-        b.speed = 0.001f + (rand() / (float)RAND_MAX) * 0.002f;
-        b.directionAngle = (rand() / (float)RAND_MAX) * 2.0f * PI;
-        b.flutterPhase = (rand() / (float)RAND_MAX) * PI;
-        b.bobPhase = (rand() / (float)RAND_MAX) * PI;
 
-        int colorType = rand() % 3;
-        if (colorType == 0) { b.r = 1.0f; b.g = 0.8f; b.b = 0.2f; } // Yellow
-        else if (colorType == 1) { b.r = 0.5f; b.g = 0.7f; b.b = 1.0f; } // Blue
-        else { b.r = 1.0f; b.g = 0.6f; b.b = 0.8f; } // Pink
+inline uint32_t randomNext(RandomStream stream) {
+    uint32_t* s = randomStreams[stream].s;
+    uint32_t result = s[0] + s[3];
+    uint32_t t = s[1] << 9;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 11) | (s[3] >> 21);
+    return result;
+}
 
-        butterflies.push_back(b);
+// Uniform float in [0, 1) from the top 24 bits.
+inline float randomFloat(RandomStream stream) {
+    return (randomNext(stream) >> 8) * (1.0f / 16777216.0f);
+}
+
+// Uniform integer in [0, n).
+inline int randomInt(RandomStream stream, int n) {
+    return (int)(((uint64_t)randomNext(stream) * (uint32_t)n) >> 32);
+}
+
+// Fills out[0..count) with uniform floats in [lo, hi).
+void randomFill(RandomStream stream, float* out, int count, float lo, float hi) {
+    uint32_t* st = randomStreams[stream].s;
+    uint32_t s0 = st[0], s1 = st[1], s2 = st[2], s3 = st[3];
+    float scale = (hi - lo) * (1.0f / 16777216.0f);
+    for (int i = 0; i < count; ++i) {
+        uint32_t result = s0 + s3;
+        uint32_t t = s1 << 9;
+        s2 ^= s0; s3 ^= s1; s1 ^= s2; s0 ^= s3; s2 ^= t;
+        s3 = (s3 << 11) | (s3 >> 21);
+        out[i] = lo + (result >> 8) * scale;
     }
+    st[0] = s0; st[1] = s1; st[2] = s2; st[3] = s3;
 }
 
-void initFireflies() {
-    fireflies.clear();
-    for (int i = 0; i < 50; ++i) {
-        Firefly f;
+// --- Job System ---
+// A small work-stealing thread pool. Every thread (the GLUT thread is index 0)
+// owns a job deque: it pops its own newest job first and steals the oldest
+// job from another thread when its own deque is empty. A thread waiting on a
+// JobCounter keeps running jobs instead of blocking, so a job may fork more
+// jobs and wait for them (parallelFor inside a simulation task).
+// The deques are fixed rings so submitting a job never allocates; a job
+// submitted to a full ring runs immediately on the submitting thread.
+// A job's closure is copied into the Job itself, so it has to be small and
+// trivially copyable; submitJob() rejects anything else at compile time.
+
+const int MAX_JOB_THREADS = 64;
+const int MAX_JOB_CHUNKS = 256;
+const int MAX_QUEUED_JOBS = 512;   // per thread
+const int JOB_CLOSURE_BYTES = 32;
+
+struct JobCounter {
+    atomic<int> pending{0};
+};
 
-        f.x = -2.5f + (rand() / (float)RAND_MAX) * 5.0f;
-        // Confine them to the ground and lower tree area
-        f.y = -0.8f + (rand() / (float)RAND_MAX) * 0.6f;
-        f.z = -0.5f + (rand() / (float)RAND_MAX) * 1.0f;
+struct Job {
+    void (*run)(const void* closure);
+    alignas(void*) unsigned char closure[JOB_CLOSURE_BYTES];
+    JobCounter* counter;
+    int profileDepth;   // jobs nest under the profiler scope that submitted them
+};
 
-        f.initialY = f.y;
-        f.speed = 0.0005f + (rand() / (float)RAND_MAX) * 0.001f;
-        f.glowPhase = (rand() / (float)RAND_MAX) * PI;
-        f.movePhaseX = (rand() / (float)RAND_MAX) * PI * 2;
-        f.movePhaseY = (rand() / (float)RAND_MAX) * PI * 2;
-        fireflies.push_back(f);
+struct JobQueue {
+    mutex lock;
+    Job jobs[MAX_QUEUED_JOBS];
+    int head = 0, count = 0;   // oldest job at jobs[head]
+};
+
+JobQueue jobQueues[MAX_JOB_THREADS];
+vector<thread> jobWorkers;
+int jobThreadCount = 0;      // 0 = one per hardware thread
+bool jobSystemRunning = false;
+int jobsQueued = 0;          // guarded by jobWakeLock
+mutex jobWakeLock;
+condition_variable jobWake;
+thread_local int jobThreadIndex = 0;
+thread_local int profileDepth = 0;  // open ProfileZones on this thread
+
+template <typename F>
+void submitJob(JobCounter& counter, const F& run) {
+    static_assert(sizeof(F) <= JOB_CLOSURE_BYTES, "job closure does not fit in Job::closure");
+    static_assert(alignof(F) <= alignof(void*), "job closure is over-aligned");
+    static_assert(is_trivially_copyable<F>::value, "job closures are copied bytewise between deques");
+    JobQueue& q = jobQueues[jobThreadIndex];
+    {
+        unique_lock<mutex> guard(q.lock);
+        if (q.count == MAX_QUEUED_JOBS) {
+            guard.unlock();
+            run();
+            return;
+        }
+        counter.pending++;
+        Job& job = q.jobs[(q.head + q.count++) % MAX_QUEUED_JOBS];
+        job.run = [](const void* closure) { (*(const F*)closure)(); };
+        new (job.closure) F(run);
+        job.counter = &counter;
+        job.profileDepth = profileDepth;
     }
+    {
+        lock_guard<mutex> guard(jobWakeLock);
+        jobsQueued++;
+    }
+    jobWake.notify_one();
 }
 
+bool takeJob(Job& job) {
+    for (int n = 0; n < jobThreadCount; ++n) {
+        int index = (jobThreadIndex + n) % jobThreadCount;
+        JobQueue& q = jobQueues[index];
+        lock_guard<mutex> guard(q.lock);
+        if (q.count == 0) continue;
+        if (n == 0) { job = q.jobs[(q.head + --q.count) % MAX_QUEUED_JOBS]; }
+        else { job = q.jobs[q.head]; q.head = (q.head + 1) % MAX_QUEUED_JOBS; q.count--; }
+        lock_guard<mutex> wakeGuard(jobWakeLock);
+        jobsQueued--;
+        return true;
+    }
+    return false;
+}
 
-void initLeaves() {
-    float y_offset = -0.1f;
-    for (int i = 0; i < LEAF_COUNT; ++i) {
-        leaves[i].x = -0.6f + (rand() / (float)RAND_MAX) * 1.2f;
-        leaves[i].y = (0.0f + y_offset) + (rand() / (float)RAND_MAX) * 0.8f;
-        leaves[i].size = 0.8f + (rand() / (float)RAND_MAX);
-        leaves[i].speed = 0.001f + (rand() / (float)RAND_MAX) * 0.001f;
-        leaves[i].sway = (rand() / (float)RAND_MAX) * 2.0f - 1.0f;
-        leaves[i].swaySpeed = 0.01f + (rand() / (float)RAND_MAX) * 0.02f;
-        leaves[i].rotation = (rand() / (float)RAND_MAX) * 360.0f;
-        leaves[i].rotationSpeed = (rand() / (float)RAND_MAX) * 2.0f - 1.0f;
-        float green_base = 0.4f + (rand() / (float)RAND_MAX) * 0.4f;
-        float red_comp = 0.1f + (rand() / (float)RAND_MAX) * 0.15f;
-        float blue_comp = 0.2f + (rand() / (float)RAND_MAX) * 0.1f;
-        leaves[i].r = red_comp; leaves[i].g = green_base; leaves[i].b = blue_comp;
+bool runOneJob() {
+    Job job;
+    if (!takeJob(job)) return false;
+    int depth = profileDepth;
+    profileDepth = job.profileDepth;
+    job.run(job.closure);
+    profileDepth = depth;
+    job.counter->pending--;
+    return true;
+}
+
+void waitForJobs(JobCounter& counter) {
+    while (counter.pending > 0) {
+        if (!runOneJob()) this_thread::yield();
     }
 }
 
-void initSnow() {
-    for (int i = 0; i < SNOW_COUNT; ++i) {
-        snowflakes[i].x = -3.0f + (rand() / (float)RAND_MAX) * 6.0f;
-        snowflakes[i].y = -1.5f + (rand() / (float)RAND_MAX) * 3.0f; // Scatter them all over
-        snowflakes[i].size = 0.003f + (rand() / (float)RAND_MAX) * 0.005f;
-        snowflakes[i].speed = 0.001f + (rand() / (float)RAND_MAX) * 0.001f;
-        snowflakes[i].swayPhase = (rand() / (float)RAND_MAX) * PI * 2.0f;
+void jobWorkerMain(int index) {
+    jobThreadIndex = index;
+    for (;;) {
+        if (runOneJob()) continue;
+        unique_lock<mutex> lock(jobWakeLock);
+        jobWake.wait(lock, [] { return jobsQueued > 0 || !jobSystemRunning; });
+        if (!jobSystemRunning) return;
     }
 }
 
-void initElves() {
-    for(int i = 0; i < ELF_COUNT; ++i) {
-        elves[i].x = -1.8f + (rand() / (float)RAND_MAX) * 3.6f;
-        elves[i].y = -0.7f;
-        elves[i].targetX = elves[i].x;
-        elves[i].speed = 0.001f + (rand() / (float)RAND_MAX) * 0.001f;
-        elves[i].state = ELF_IDLE;
-        elves[i].stateTimer = 2.0f + (rand() / (float)RAND_MAX) * 3.0f; // Idle for 2-5 seconds
-        elves[i].animationPhase = 0.0f;
+void initJobSystem() {
+    if (jobThreadCount <= 0) jobThreadCount = (int)thread::hardware_concurrency();
+    if (jobThreadCount < 1) jobThreadCount = 1;
+    if (jobThreadCount > MAX_JOB_THREADS) jobThreadCount = MAX_JOB_THREADS;
 
-        if (i % 3 == 0) { elves[i].r = 0.8f; elves[i].g = 0.1f; elves[i].b = 0.2f; } // Red tunic
-        else if (i % 3 == 1) { elves[i].r = 0.1f; elves[i].g = 0.2f; elves[i].b = 0.8f; } // Blue tunic
-        else { elves[i].r = 0.1f; elves[i].g = 0.6f; elves[i].b = 0.3f; } // Green tunic
+    jobSystemRunning = true;
+    for (int i = 1; i < jobThreadCount; ++i) {
+        jobWorkers.emplace_back(jobWorkerMain, i);
     }
+    printf("Job system: %d threads\n", jobThreadCount);
 }
 
-void initStars() {
-    for (int i = 0; i < STAR_COUNT; ++i) {
-        stars[i].x = -2.5f + (rand() / (float)RAND_MAX) * 5.0f;
-        stars[i].y = (rand() / (float)RAND_MAX) * 1.5f;
-        stars[i].radius = 0.002f + (rand() / (float)RAND_MAX) * 0.004f;
-        stars[i].twinkleSpeed = 0.5f + (rand() / (float)RAND_MAX) * 1.5f;
-        stars[i].initialPhase = (rand() / (float)RAND_MAX) * PI * 2.0f;
-        stars[i].alpha = 0.0f;
+void shutdownJobSystem() {
+    {
+        lock_guard<mutex> guard(jobWakeLock);
+        jobSystemRunning = false;
     }
+    jobWake.notify_all();
+    for (auto& worker : jobWorkers) worker.join();
+    jobWorkers.clear();
 }
 
-void initBirds() {
-    for (int i = 0; i < MAX_BIRDS; i++) {
-        birds[i].x = -3.0f - (static_cast<float>(rand()) / RAND_MAX) * 5.0f;
-        birds[i].y = 0.8f + (static_cast<float>(rand()) / RAND_MAX) * 0.6f;
-        birds[i].speed = 0.006f + (static_cast<float>(rand()) / RAND_MAX) * 0.004f;
-        birds[i].phase = (static_cast<float>(rand()) / RAND_MAX) * 3.14159f;
-    }
+// Size of the chunks parallelFor should split count items into: a few chunks
+// per thread for balance, but never smaller than minChunkSize.
+int jobChunkSize(int count, int minChunkSize) {
+    int chunks = jobThreadCount * 4;
+    int size = (count + chunks - 1) / chunks;
+    if (size < minChunkSize) size = minChunkSize;
+    if ((count + size - 1) / size > MAX_JOB_CHUNKS) size = (count + MAX_JOB_CHUNKS - 1) / MAX_JOB_CHUNKS;
+    return size;
 }
 
+// Runs body(chunk, chunkBegin, chunkEnd) over [begin, end) in chunkSize pieces
+// and returns once every chunk has finished. The per-chunk job only captures
+// the shared range and its chunk index, so it fits in Job::closure.
+void parallelFor(int begin, int end, int chunkSize, const function<void(int, int, int)>& body) {
+    struct Range {
+        const function<void(int, int, int)>* body;
+        int begin, end, chunkSize;
+    } range = { &body, begin, end, chunkSize };
+    JobCounter counter;
+    int chunk = 0;
+    for (int b = begin; b < end; b += chunkSize, ++chunk) {
+        submitJob(counter, [&range, chunk] {
+            int b = range.begin + chunk * range.chunkSize;
+            int e = b + range.chunkSize < range.end ? b + range.chunkSize : range.end;
+            (*range.body)(chunk, b, e);
+        });
+    }
+    waitForJobs(counter);
+}
 
-void initClouds() {
-    float section_width = 8.0f / CLOUD_COUNT;
+// --- Allocation Counter ---
+// Every heap allocation in the program goes through these, so the benchmark
+// can report how many allocations a scenario makes. The per-thread count lets
+// a ProfileZone attribute allocations to the scope that made them.
 
-    for (int i = 0; i < CLOUD_COUNT; ++i) {
-        // --- Basic Cloud Properties ---
-        clouds[i].x = -4.0f + i * section_width + ((rand() / (float)RAND_MAX) - 0.5f) * section_width;
-        clouds[i].y = 0.6f + (rand() / (float)RAND_MAX) * 0.7f;
-        clouds[i].speed = (0.001f + (rand() / (float)RAND_MAX) * 0.0015f) * 2.0f;
+atomic<long long> allocationCount{0};
+thread_local long long threadAllocationCount = 0;
 
+void* operator new(size_t size) {
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    threadAllocationCount++;
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
 
-        clouds[i].circles[0].radius = (0.12f + (rand() / (float)RAND_MAX) * 0.03f);
-        clouds[i].circles[0].yScale = 0.5f;
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+// --- Frame Profiler ---
+// ProfileZone times the scope it lives in and records the GL calls and heap
+// allocations made inside it. Zones nest per thread (and across jobs, see Job::profileDepth);
+// each (name, depth) pair gets one ProfileStat. On the GLUT thread, inside a
+// frame, zones also bracket themselves with GL timestamp queries, which are
+// read back GPU_QUERY_FRAMES frames later so the CPU never waits on them.
+// The profiler only runs while its overlay is shown or a trace is recorded.
+
+const int MAX_PROFILE_STATS = 96;
+const int MAX_GPU_SCOPES = 64;     // per frame
+const int GPU_QUERY_FRAMES = 4;
+
+#ifndef GL_TIMESTAMP
+#define GL_TIMESTAMP 0x8E28
+#endif
+#ifndef GL_QUERY_RESULT
+#define GL_QUERY_RESULT 0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE
+#define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+
+typedef void (GLAPIENTRY *GenQueriesProc)(GLsizei, GLuint*);
+typedef void (GLAPIENTRY *QueryCounterProc)(GLuint, GLenum);
+typedef void (GLAPIENTRY *GetQueryObjectivProc)(GLuint, GLenum, GLint*);
+typedef void (GLAPIENTRY *GetQueryObjectui64vProc)(GLuint, GLenum, uint64_t*);
+typedef void (GLAPIENTRY *GetInteger64vProc)(GLenum, int64_t*);
+
+GenQueriesProc genQueries = NULL;
+QueryCounterProc queryCounter = NULL;
+GetQueryObjectivProc getQueryObjectiv = NULL;
+GetQueryObjectui64vProc getQueryObjectui64v = NULL;
+GetInteger64vProc getInteger64v = NULL;
+
+struct ProfileStat {
+    const char* name;
+    int depth;
+    // accumulated over the current frame
+    double cpuMs;
+    long long vertices, drawCalls, stateChanges, allocations;
+    // shown by the overlay and the summary
+    double avgCpuMs, avgGpuMs;
+    long long lastVertices, lastDrawCalls, lastStateChanges, lastAllocations;
+    double totalCpuMs, totalGpuMs;
+    long long totalAllocations;
+};
 
+struct TraceEvent {
+    const char* name;
+    int thread;
+    double startUs, durUs;
+    long long vertices, drawCalls, stateChanges, allocations;
+};
 
-        int num_puffs = 5 + rand() % 6;
-        clouds[i].num_circles = num_puffs + 1;
+struct GpuScope {
+    int stat;
+    double cpuStartUs;
+};
 
-        for (int j = 1; j <= num_puffs; j++) {
-            CloudCircle& c = clouds[i].circles[j];
+struct GpuFrame {
+    GLuint queries[MAX_GPU_SCOPES * 2];
+    GpuScope scopes[MAX_GPU_SCOPES];
+    int count;
+};
 
-            c.x_offset = ( (rand() / (float)RAND_MAX) - 0.5f ) * clouds[i].circles[0].radius * 1.8f;
-            c.y_offset = ( (rand() / (float)RAND_MAX) * 0.5f ) * clouds[i].circles[0].radius;
+ProfileStat profileStats[MAX_PROFILE_STATS];
+int profileStatCount = 0;
+int profileFrameCount = 0;
+mutex profileLock;
+atomic<bool> profilerRunning{false};
+bool profilerOverlayVisible = false;
+bool profileReport = false;         // headless --profile: print a summary at exit
+bool profileInFrame = false;
+chrono::steady_clock::time_point profileEpoch = chrono::steady_clock::now();
+
+vector<TraceEvent> traceEvents;
+atomic<int> traceFramesLeft(0);
+const int TRACE_DEFAULT_FRAMES = 300;
+const char* tracePath = "silvine_trace.json";
+const int TRACE_GPU_THREAD = 1000;  // trace track for GPU scopes
+
+bool gpuTimersAvailable = false;
+GpuFrame gpuFrames[GPU_QUERY_FRAMES];
+int gpuFrameIndex = 0;
+double gpuClockOffsetUs = 0.0;      // CPU trace time minus GPU timestamp
+
+double profileNowUs() {
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - profileEpoch).count();
+}
 
-            c.radius = clouds[i].circles[0].radius * (0.4f + (rand() / (float)RAND_MAX) * 0.5f);
-            c.yScale = 1.0f;
-        }
+// Returns the stat for (name, depth), adding it on first use. Caller holds profileLock.
+int findProfileStat(const char* name, int depth) {
+    for (int i = 0; i < profileStatCount; ++i) {
+        if (profileStats[i].depth == depth && strcmp(profileStats[i].name, name) == 0) return i;
     }
+    if (profileStatCount == MAX_PROFILE_STATS) return -1;
+    ProfileStat& s = profileStats[profileStatCount];
+    memset(&s, 0, sizeof(s));
+    s.name = name;
+    s.depth = depth;
+    return profileStatCount++;
 }
 
-
-void initSceneElements() {
-    srand(static_cast<unsigned int>(time(nullptr)));
-    initLeaves();
-    initElves();
-    initStars();
-    initClouds();
-    initBirds();
-    initRain();
-    initButterflies();
-    initFireflies();
-    initSnow();
-
-    // Initialize campfire
-    campfires.push_back({-1.5f, -0.6f});
-    if (!campfires.empty()) {
-        campfires[0].flamePhase1 = 0.0f;
-        campfires[0].flamePhase2 = PI / 2.0f;
+void initProfiler(void* (*getProc)(const char*)) {
+    const char* version = (const char*)glGetString(GL_VERSION);
+    const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+    int major = 0, minor = 0;
+    if (version) sscanf(version, "%d.%d", &major, &minor);
+    bool supported = major > 3 || (major == 3 && minor >= 3) ||
+                     (extensions && strstr(extensions, "GL_ARB_timer_query"));
+    if (supported) {
+        genQueries = (GenQueriesProc)getProc("glGenQueries");
+        queryCounter = (QueryCounterProc)getProc("glQueryCounter");
+        getQueryObjectiv = (GetQueryObjectivProc)getProc("glGetQueryObjectiv");
+        getQueryObjectui64v = (GetQueryObjectui64vProc)getProc("glGetQueryObjectui64v");
+        getInteger64v = (GetInteger64vProc)getProc("glGetInteger64v");
+        supported = genQueries && queryCounter && getQueryObjectiv && getQueryObjectui64v && getInteger64v;
+    }
+    if (!supported) {
+        printf("Profiler: GL timer queries unavailable, CPU timing only\n");
+        return;
     }
 
-    // Initialize Fox
-    fox.progress = 0.0f;
-    fox.speed = 0.05f;
-    fox.tailSway = 0.0f;
-
-    glClearColor(0.6f, 0.8f, 1.0f, 1.0f);
+    for (int i = 0; i < GPU_QUERY_FRAMES; ++i) {
+        genQueries(MAX_GPU_SCOPES * 2, gpuFrames[i].queries);
+        gpuFrames[i].count = 0;
+    }
+    int64_t gpuNow = 0;
+    getInteger64v(GL_TIMESTAMP, &gpuNow);
+    gpuClockOffsetUs = profileNowUs() - gpuNow / 1000.0;
+    gpuTimersAvailable = true;
 }
-// --- Update Functions ---
-
-void updateElves() {
-    TimeMoment tm = getTimeMoment();
-    if (tm == NIGHT || currentWeather == RAINY || currentWeather == SNOWY) return;
-
-    for(int i = 0; i < ELF_COUNT; ++i) {
-        elves[i].stateTimer -= 0.016f; // Decrease timer
 
-        if (elves[i].stateTimer <= 0) {
-            if (elves[i].state == ELF_IDLE) {
-                // Switch to walking
-                elves[i].state = ELF_WALKING;
-                elves[i].stateTimer = 5.0f + (rand() / (float)RAND_MAX) * 5.0f; // Walk for 5-10 seconds
-                // Pick a new target
-                elves[i].targetX = -1.8f + (rand() / (float)RAND_MAX) * 3.6f;
-            } else {
-                // Switch to idle
-                elves[i].state = ELF_IDLE;
-                elves[i].stateTimer = 2.0f + (rand() / (float)RAND_MAX) * 3.0f; // Idle for 2-5 seconds
-            }
-        }
-
-        if (elves[i].state == ELF_WALKING) {
-            // Move towards target
-            if (elves[i].x < elves[i].targetX) {
-                elves[i].x += elves[i].speed;
-            } else {
-                 elves[i].x -= elves[i].speed;
+// Reads back a frame's timestamp queries if the GPU has finished them;
+// otherwise the frame's GPU timings are dropped.
+void collectGpuFrame(GpuFrame& frame) {
+    if (frame.count == 0) return;
+    GLint available = 0;
+    getQueryObjectiv(frame.queries[frame.count * 2 - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+        lock_guard<mutex> guard(profileLock);
+        for (int i = 0; i < frame.count; ++i) {
+            uint64_t begin = 0, end = 0;
+            getQueryObjectui64v(frame.queries[i * 2], GL_QUERY_RESULT, &begin);
+            getQueryObjectui64v(frame.queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+            double ms = (end - begin) / 1.0e6;
+            ProfileStat& s = profileStats[frame.scopes[i].stat];
+            s.avgGpuMs = s.avgGpuMs * 0.9 + ms * 0.1;
+            s.totalGpuMs += ms;
+            if (traceFramesLeft > 0) {
+                traceEvents.push_back({s.name, TRACE_GPU_THREAD, begin / 1000.0 + gpuClockOffsetUs,
+                                       (end - begin) / 1000.0, 0, 0, 0, 0});
             }
-            elves[i].animationPhase += 0.2f; // Update animation phase
         }
     }
+    frame.count = 0;
 }
 
-void updateButterflies() {
+int beginGpuScope(int stat) {
+    if (!gpuTimersAvailable || !profileInFrame || jobThreadIndex != 0) return -1;
+    GpuFrame& frame = gpuFrames[gpuFrameIndex];
+    if (frame.count == MAX_GPU_SCOPES) return -1;
+    int index = frame.count++;
+    frame.scopes[index].stat = stat;
+    queryCounter(frame.queries[index * 2], GL_TIMESTAMP);
+    return index;
+}
 
-    if (currentWeather == RAINY || currentWeather == SNOWY) {
-        if (!butterflies.empty()) {
-            butterflies.clear();
+void endGpuScope(int index) {
+    if (index < 0) return;
+    queryCounter(gpuFrames[gpuFrameIndex].queries[index * 2 + 1], GL_TIMESTAMP);
+}
+
+class ProfileZone {
+public:
+    explicit ProfileZone(const char* name) : stat(-1), gpuScope(-1) {
+        if (!profilerRunning) return;
+        {
+            lock_guard<mutex> guard(profileLock);
+            stat = findProfileStat(name, profileDepth);
         }
-        return;
+        if (stat < 0) return;
+        profileDepth++;
+        counts = glCalls;
+        allocationsBefore = threadAllocationCount;
+        gpuScope = beginGpuScope(stat);
+        startUs = profileNowUs();
     }
 
-
-    if (butterflies.empty()) {
-        initButterflies();
+    ~ProfileZone() {
+        if (stat < 0) return;
+        double endUs = profileNowUs();
+        endGpuScope(gpuScope);
+        profileDepth--;
+
+        long long vertices = glCalls.vertices - counts.vertices;
+        long long drawCalls = glCalls.drawCalls - counts.drawCalls;
+        long long stateChanges = glCalls.stateChanges - counts.stateChanges;
+        long long allocations = threadAllocationCount - allocationsBefore;
+
+        lock_guard<mutex> guard(profileLock);
+        ProfileStat& s = profileStats[stat];
+        s.cpuMs += (endUs - startUs) / 1000.0;
+        s.vertices += vertices;
+        s.drawCalls += drawCalls;
+        s.stateChanges += stateChanges;
+        s.allocations += allocations;
+        if (traceFramesLeft > 0) {
+            traceEvents.push_back({s.name, jobThreadIndex, startUs, endUs - startUs, vertices, drawCalls, stateChanges, allocations});
+        }
     }
 
-    for (auto& b : butterflies) {
-        b.x += cosf(b.directionAngle) * b.speed;
-        // Bobbing motion
-        b.y = b.initialY + 0.05f * sinf(b.bobPhase);
-
-        b.flutterPhase += 0.3f;
-        b.bobPhase += 0.05f;
+private:
+    int stat, gpuScope;
+    double startUs;
+    GLCallCounts counts;
+    long long allocationsBefore;
+};
 
-        // Occasionally change direction
-        if (rand() % 100 == 0) {
-            b.directionAngle += ((rand() / (float)RAND_MAX) - 0.5f);
-        }
+// Formats a vertex, draw call or state change count, or "n/a" when the GL
+// call wrappers are compiled out and the counters stay at zero.
+const char* glCountText(char* buffer, size_t size, long long count) {
+#if PROFILE_GL_CALLS
+    snprintf(buffer, size, "%lld", count);
+#else
+    (void)count;
+    snprintf(buffer, size, "n/a");
+#endif
+    return buffer;
+}
 
-        // Wrap around screen edges
-        if (b.x > 2.7f) b.x = -2.7f;
-        if (b.x < -2.7f) b.x = 2.7f;
+void writeChromeTrace(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        printf("Profiler: could not write %s\n", path);
+        return;
+    }
+    fprintf(file, "{\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"GPU\"}}", TRACE_GPU_THREAD);
+    for (const TraceEvent& e : traceEvents) {
+#if PROFILE_GL_CALLS
+        fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                      "\"args\":{\"vertices\":%lld,\"drawCalls\":%lld,\"stateChanges\":%lld,\"allocations\":%lld}}",
+                e.name, e.thread, e.startUs, e.durUs, e.vertices, e.drawCalls, e.stateChanges, e.allocations);
+#else
+        fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                      "\"args\":{\"allocations\":%lld}}",
+                e.name, e.thread, e.startUs, e.durUs, e.allocations);
+#endif
     }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    printf("Profiler: wrote %d events to %s\n", (int)traceEvents.size(), path);
+    traceEvents.clear();
+    traceFramesLeft = 0;
 }
 
+// Starts recording the next `frames` frames into a Chrome trace (chrome://tracing).
+void startTrace(int frames) {
+    lock_guard<mutex> guard(profileLock);
+    traceEvents.clear();
+    traceFramesLeft = frames;
+}
 
+void profileBeginFrame() {
+    profilerRunning = profilerOverlayVisible || profileReport || traceFramesLeft > 0;
+    if (!profilerRunning) return;
+    if (gpuTimersAvailable) {
+        gpuFrameIndex = (gpuFrameIndex + 1) % GPU_QUERY_FRAMES;
+        collectGpuFrame(gpuFrames[gpuFrameIndex]);
+    }
+    profileInFrame = true;
+}
 
-void updateAudio() {
+// Folds this frame's totals into the overlay averages and finishes a trace
+// once its frames are recorded.
+void profileEndFrame() {
+    if (!profileInFrame) return;
+    profileInFrame = false;
+
+    lock_guard<mutex> guard(profileLock);
+    for (int i = 0; i < profileStatCount; ++i) {
+        ProfileStat& s = profileStats[i];
+        s.avgCpuMs = profileFrameCount == 0 ? s.cpuMs : s.avgCpuMs * 0.9 + s.cpuMs * 0.1;
+        s.totalCpuMs += s.cpuMs;
+        s.lastVertices = s.vertices;
+        s.lastDrawCalls = s.drawCalls;
+        s.lastStateChanges = s.stateChanges;
+        s.lastAllocations = s.allocations;
+        s.totalAllocations += s.allocations;
+        s.cpuMs = 0.0;
+        s.vertices = s.drawCalls = s.stateChanges = s.allocations = 0;
+    }
+    renderQueueLast = renderQueueFrame;
+    renderQueueTotal.commands += renderQueueFrame.commands;
+    renderQueueTotal.drawCallsSubmitted += renderQueueFrame.drawCallsSubmitted;
+    renderQueueTotal.drawCallsIssued += renderQueueFrame.drawCallsIssued;
+    renderQueueTotal.stateChangesSubmitted += renderQueueFrame.stateChangesSubmitted;
+    renderQueueTotal.stateChangesIssued += renderQueueFrame.stateChangesIssued;
+    renderQueueFrame = {};
+    profileFrameCount++;
+    if (traceFramesLeft > 0 && --traceFramesLeft == 0) writeChromeTrace(tracePath);
+}
 
-    Mix_HaltMusic();
-    if (birdChannel != -1) Mix_HaltChannel(birdChannel);
-    if (rainChannel != -1) Mix_HaltChannel(rainChannel);
-    if (thunderChannel != -1) Mix_HaltChannel(thunderChannel);
+// Prints per-scope averages over every profiled frame.
+void printProfileSummary() {
+    lock_guard<mutex> guard(profileLock);
+    int frames = profileFrameCount > 0 ? profileFrameCount : 1;
+    if (!PROFILE_GL_CALLS) printf("GL call counting disabled (build with -DPROFILE_GL_CALLS=1)\n");
+    printf("%-32s %9s %9s %8s %6s %7s %8s\n", "scope", "cpu ms", "gpu ms", "verts", "draws", "states", "allocs/f");
+    char vertices[24], drawCalls[24], stateChanges[24];
+    for (int i = 0; i < profileStatCount; ++i) {
+        const ProfileStat& s = profileStats[i];
+        printf("%*s%-*s %9.3f %9.3f %8s %6s %7s %8.2f\n", s.depth * 2, "", 32 - s.depth * 2, s.name,
+               s.totalCpuMs / frames, s.totalGpuMs / frames, glCountText(vertices, sizeof(vertices), s.lastVertices),
+               glCountText(drawCalls, sizeof(drawCalls), s.lastDrawCalls),
+               glCountText(stateChanges, sizeof(stateChanges), s.lastStateChanges), (double)s.totalAllocations / frames);
+    }
+    const RenderQueueStats& q = renderQueueTotal;
+    printf("render queue per frame: %.1f commands, state changes %.1f unsorted (estimated) -> %.1f sorted, "
+           "draw calls %.1f unsorted (estimated) -> %.1f sorted\n",
+           (double)q.commands / frames, (double)q.stateChangesSubmitted / frames, (double)q.stateChangesIssued / frames,
+           (double)q.drawCallsSubmitted / frames, (double)q.drawCallsIssued / frames);
+    printf("frame arena peak: %zu KB\n", frameArena.peakBytes / 1024);
+}
 
+// --- Weather Kernels ---
+// Per-element update loops for falling leaves, rain and snow. Each kernel has
+// a scalar version plus SSE2 and AVX2 versions; selectWeatherKernels() picks
+// the widest one the CPU supports. All paths share the same sine polynomial
+// and per-element xorshift generator, so they produce the same scene.
+
+const float TWO_PI = 2.0f * PI;
+const float HALF_PI = 0.5f * PI;
+const float INV_TWO_PI = 1.0f / TWO_PI;
+const float SIN_C3 = -1.0f / 6.0f;
+const float SIN_C5 = 1.0f / 120.0f;
+const float SIN_C7 = -1.0f / 5040.0f;
+const float RNG_UNIT = 1.0f / 16777216.0f;
+
+uint32_t makeKernelSeed(RandomStream stream) {
+    uint32_t seed = randomNext(stream);
+    return seed != 0 ? seed : 1u;
+}
 
-    switch (currentWeather) {
-        case RAINY:
-            if (rainSound) rainChannel = Mix_PlayChannel(-1, rainSound, -1);
-            if (thunderSound) thunderChannel = Mix_PlayChannel(-1, thunderSound, -1);
-            break;
+// Sine approximation: wrap to [-PI, PI], fold to [-PI/2, PI/2], odd polynomial.
+inline float kernelSinf(float x) {
+    x -= TWO_PI * (float)lrintf(x * INV_TWO_PI);
+    if (x > HALF_PI) x = PI - x;
+    else if (x < -HALF_PI) x = -PI - x;
+    float x2 = x * x;
+    float p = SIN_C7;
+    p = p * x2 + SIN_C5;
+    p = p * x2 + SIN_C3;
+    p = p * x2 + 1.0f;
+    return p * x;
+}
 
-        case SUNNY:
-            if (riverSound) Mix_PlayMusic(riverSound, -1);
-            if (birdSound) birdChannel = Mix_PlayChannel(-1, birdSound, -1);
-            break;
+inline uint32_t kernelXorshift(uint32_t s) {
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    return s;
+}
 
-        case SNOWY:
+inline float kernelUnit(uint32_t s) {
+    return (float)(s >> 8) * RNG_UNIT;
+}
 
-            if (winterSound) Mix_PlayMusic(winterSound, -1);
-            break;
+void leafKernelScalar(int begin, int end) {
+    LeafField& l = leaves;
+    for (int i = begin; i < end; ++i) {
+        l.y[i] -= l.speed[i];
+        l.x[i] += kernelSinf(l.sway[i]) * 0.001f;
+        l.sway[i] += l.swaySpeed[i];
+        l.rotation[i] += l.rotationSpeed[i];
+
+        uint32_t s1 = kernelXorshift(l.seed[i]);
+        uint32_t s2 = kernelXorshift(s1);
+        l.seed[i] = s2;
+        if (l.y[i] < -1.5f) {
+            l.x[i] = -0.6f + kernelUnit(s1) * 1.2f;
+            l.y[i] = -0.1f + kernelUnit(s2) * 0.8f;
+        }
     }
 }
 
-void updateFireflies() {
-
-    if (getTimeMoment() != NIGHT || currentWeather == RAINY || currentWeather == SNOWY) {
-        if (!fireflies.empty()) {
-            fireflies.clear();
+int rainKernelScalar(int begin, int end, float* hitX, float* hitY) {
+    RainField& r = raindrops;
+    int hits = 0;
+    for (int i = begin; i < end; ++i) {
+        r.y[i] -= r.speed[i];
+
+        uint32_t s = kernelXorshift(r.seed[i]);
+        r.seed[i] = s;
+        if (r.y[i] < -1.1f) {
+            hitX[hits] = r.x[i];
+            hitY[hits] = r.y[i];
+            hits++;
+            r.y[i] = 1.5f;
+            r.x[i] = -2.5f + kernelUnit(s) * 5.0f;
         }
-        return;
     }
+    return hits;
+}
 
+void snowKernelScalar(int begin, int end) {
+    SnowField& f = snowflakes;
+    for (int i = begin; i < end; ++i) {
+        f.y[i] -= f.speed[i];
+        // Add a gentle horizontal sway
+        f.x[i] += kernelSinf(f.swayPhase[i] + f.y[i] * 2.0f) * 0.001f;
 
-    if (fireflies.empty()) {
-        initFireflies();
+        uint32_t s = kernelXorshift(f.seed[i]);
+        f.seed[i] = s;
+        // Reset snowflake to the top when it falls off-screen
+        if (f.y[i] < -1.5f) {
+            f.y[i] = 1.5f;
+            f.x[i] = -3.0f + kernelUnit(s) * 6.0f;
+        }
     }
+}
 
-    for (auto& f : fireflies) {
-        f.movePhaseX += 0.03f * f.speed * 100;
-        f.movePhaseY += 0.02f * f.speed * 100;
+#if WEATHER_SIMD
 
-        f.x += cosf(f.movePhaseX) * 0.001f;
-        f.y += sinf(f.movePhaseY) * 0.0005f;
+// --- SSE2 (4 lanes) ---
+
+static inline __m128 select4(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline __m128 sin4(__m128 x) {
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    __m128 k = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(INV_TWO_PI))));
+    x = _mm_sub_ps(x, _mm_mul_ps(k, _mm_set1_ps(TWO_PI)));
+
+    __m128 sign = _mm_and_ps(x, signMask);
+    __m128 fold = _mm_cmpgt_ps(_mm_andnot_ps(signMask, x), _mm_set1_ps(HALF_PI));
+    __m128 reflected = _mm_sub_ps(_mm_or_ps(_mm_set1_ps(PI), sign), x);
+    x = select4(fold, reflected, x);
+
+    __m128 x2 = _mm_mul_ps(x, x);
+    __m128 p = _mm_set1_ps(SIN_C7);
+    p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(SIN_C5));
+    p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(SIN_C3));
+    p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(1.0f));
+    return _mm_mul_ps(p, x);
+}
+
+static inline __m128i xorshift4(__m128i s) {
+    s = _mm_xor_si128(s, _mm_slli_epi32(s, 13));
+    s = _mm_xor_si128(s, _mm_srli_epi32(s, 17));
+    s = _mm_xor_si128(s, _mm_slli_epi32(s, 5));
+    return s;
+}
+
+static inline __m128 unit4(__m128i s) {
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(s, 8)), _mm_set1_ps(RNG_UNIT));
+}
+
+void leafKernelSse2(int begin, int end) {
+    LeafField& l = leaves;
+    int i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 y = _mm_sub_ps(_mm_loadu_ps(&l.y[i]), _mm_loadu_ps(&l.speed[i]));
+        __m128 sway = _mm_loadu_ps(&l.sway[i]);
+        __m128 x = _mm_add_ps(_mm_loadu_ps(&l.x[i]), _mm_mul_ps(sin4(sway), _mm_set1_ps(0.001f)));
+        _mm_storeu_ps(&l.sway[i], _mm_add_ps(sway, _mm_loadu_ps(&l.swaySpeed[i])));
+        _mm_storeu_ps(&l.rotation[i], _mm_add_ps(_mm_loadu_ps(&l.rotation[i]), _mm_loadu_ps(&l.rotationSpeed[i])));
+
+        __m128i s1 = xorshift4(_mm_loadu_si128((const __m128i*)&l.seed[i]));
+        __m128i s2 = xorshift4(s1);
+        _mm_storeu_si128((__m128i*)&l.seed[i], s2);
+
+        __m128 respawn = _mm_cmplt_ps(y, _mm_set1_ps(-1.5f));
+        x = select4(respawn, _mm_add_ps(_mm_set1_ps(-0.6f), _mm_mul_ps(unit4(s1), _mm_set1_ps(1.2f))), x);
+        y = select4(respawn, _mm_add_ps(_mm_set1_ps(-0.1f), _mm_mul_ps(unit4(s2), _mm_set1_ps(0.8f))), y);
+        _mm_storeu_ps(&l.x[i], x);
+        _mm_storeu_ps(&l.y[i], y);
+    }
+    leafKernelScalar(i, end);
+}
+
+int rainKernelSse2(int begin, int end, float* hitX, float* hitY) {
+    RainField& r = raindrops;
+    int hits = 0;
+    int i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 y = _mm_sub_ps(_mm_loadu_ps(&r.y[i]), _mm_loadu_ps(&r.speed[i]));
+        __m128 x = _mm_loadu_ps(&r.x[i]);
+        __m128i s = xorshift4(_mm_loadu_si128((const __m128i*)&r.seed[i]));
+        _mm_storeu_si128((__m128i*)&r.seed[i], s);
+
+        __m128 hit = _mm_cmplt_ps(y, _mm_set1_ps(-1.1f));
+        int mask = _mm_movemask_ps(hit);
+        if (mask) {
+            float hx[4], hy[4];
+            _mm_storeu_ps(hx, x);
+            _mm_storeu_ps(hy, y);
+            for (int lane = 0; lane < 4; ++lane) {
+                if (mask & (1 << lane)) {
+                    hitX[hits] = hx[lane];
+                    hitY[hits] = hy[lane];
+                    hits++;
+                }
+            }
+            y = select4(hit, _mm_set1_ps(1.5f), y);
+            x = select4(hit, _mm_add_ps(_mm_set1_ps(-2.5f), _mm_mul_ps(unit4(s), _mm_set1_ps(5.0f))), x);
+            _mm_storeu_ps(&r.x[i], x);
+        }
+        _mm_storeu_ps(&r.y[i], y);
+    }
+    return hits + rainKernelScalar(i, end, hitX + hits, hitY + hits);
+}
+
+void snowKernelSse2(int begin, int end) {
+    SnowField& f = snowflakes;
+    int i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 y = _mm_sub_ps(_mm_loadu_ps(&f.y[i]), _mm_loadu_ps(&f.speed[i]));
+        __m128 phase = _mm_add_ps(_mm_loadu_ps(&f.swayPhase[i]), _mm_mul_ps(y, _mm_set1_ps(2.0f)));
+        __m128 x = _mm_add_ps(_mm_loadu_ps(&f.x[i]), _mm_mul_ps(sin4(phase), _mm_set1_ps(0.001f)));
+
+        __m128i s = xorshift4(_mm_loadu_si128((const __m128i*)&f.seed[i]));
+        _mm_storeu_si128((__m128i*)&f.seed[i], s);
+
+        __m128 respawn = _mm_cmplt_ps(y, _mm_set1_ps(-1.5f));
+        y = select4(respawn, _mm_set1_ps(1.5f), y);
+        x = select4(respawn, _mm_add_ps(_mm_set1_ps(-3.0f), _mm_mul_ps(unit4(s), _mm_set1_ps(6.0f))), x);
+        _mm_storeu_ps(&f.x[i], x);
+        _mm_storeu_ps(&f.y[i], y);
+    }
+    snowKernelScalar(i, end);
+}
+
+// --- AVX2 (8 lanes) ---
+
+__attribute__((target("avx2")))
+static inline __m256 sin8(__m256 x) {
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    __m256 k = _mm256_cvtepi32_ps(_mm256_cvtps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(INV_TWO_PI))));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(k, _mm256_set1_ps(TWO_PI)));
+
+    __m256 sign = _mm256_and_ps(x, signMask);
+    __m256 fold = _mm256_cmp_ps(_mm256_andnot_ps(signMask, x), _mm256_set1_ps(HALF_PI), _CMP_GT_OQ);
+    __m256 reflected = _mm256_sub_ps(_mm256_or_ps(_mm256_set1_ps(PI), sign), x);
+    x = _mm256_blendv_ps(x, reflected, fold);
+
+    __m256 x2 = _mm256_mul_ps(x, x);
+    __m256 p = _mm256_set1_ps(SIN_C7);
+    p = _mm256_add_ps(_mm256_mul_ps(p, x2), _mm256_set1_ps(SIN_C5));
+    p = _mm256_add_ps(_mm256_mul_ps(p, x2), _mm256_set1_ps(SIN_C3));
+    p = _mm256_add_ps(_mm256_mul_ps(p, x2), _mm256_set1_ps(1.0f));
+    return _mm256_mul_ps(p, x);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i xorshift8(__m256i s) {
+    s = _mm256_xor_si256(s, _mm256_slli_epi32(s, 13));
+    s = _mm256_xor_si256(s, _mm256_srli_epi32(s, 17));
+    s = _mm256_xor_si256(s, _mm256_slli_epi32(s, 5));
+    return s;
+}
+
+__attribute__((target("avx2")))
+static inline __m256 unit8(__m256i s) {
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(s, 8)), _mm256_set1_ps(RNG_UNIT));
+}
+
+__attribute__((target("avx2")))
+void leafKernelAvx2(int begin, int end) {
+    LeafField& l = leaves;
+    int i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 y = _mm256_sub_ps(_mm256_loadu_ps(&l.y[i]), _mm256_loadu_ps(&l.speed[i]));
+        __m256 sway = _mm256_loadu_ps(&l.sway[i]);
+        __m256 x = _mm256_add_ps(_mm256_loadu_ps(&l.x[i]), _mm256_mul_ps(sin8(sway), _mm256_set1_ps(0.001f)));
+        _mm256_storeu_ps(&l.sway[i], _mm256_add_ps(sway, _mm256_loadu_ps(&l.swaySpeed[i])));
+        _mm256_storeu_ps(&l.rotation[i], _mm256_add_ps(_mm256_loadu_ps(&l.rotation[i]), _mm256_loadu_ps(&l.rotationSpeed[i])));
+
+        __m256i s1 = xorshift8(_mm256_loadu_si256((const __m256i*)&l.seed[i]));
+        __m256i s2 = xorshift8(s1);
+        _mm256_storeu_si256((__m256i*)&l.seed[i], s2);
+
+        __m256 respawn = _mm256_cmp_ps(y, _mm256_set1_ps(-1.5f), _CMP_LT_OQ);
+        x = _mm256_blendv_ps(x, _mm256_add_ps(_mm256_set1_ps(-0.6f), _mm256_mul_ps(unit8(s1), _mm256_set1_ps(1.2f))), respawn);
+        y = _mm256_blendv_ps(y, _mm256_add_ps(_mm256_set1_ps(-0.1f), _mm256_mul_ps(unit8(s2), _mm256_set1_ps(0.8f))), respawn);
+        _mm256_storeu_ps(&l.x[i], x);
+        _mm256_storeu_ps(&l.y[i], y);
+    }
+    leafKernelScalar(i, end);
+}
+
+__attribute__((target("avx2")))
+int rainKernelAvx2(int begin, int end, float* hitX, float* hitY) {
+    RainField& r = raindrops;
+    int hits = 0;
+    int i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 y = _mm256_sub_ps(_mm256_loadu_ps(&r.y[i]), _mm256_loadu_ps(&r.speed[i]));
+        __m256 x = _mm256_loadu_ps(&r.x[i]);
+        __m256i s = xorshift8(_mm256_loadu_si256((const __m256i*)&r.seed[i]));
+        _mm256_storeu_si256((__m256i*)&r.seed[i], s);
+
+        __m256 hit = _mm256_cmp_ps(y, _mm256_set1_ps(-1.1f), _CMP_LT_OQ);
+        int mask = _mm256_movemask_ps(hit);
+        if (mask) {
+            float hx[8], hy[8];
+            _mm256_storeu_ps(hx, x);
+            _mm256_storeu_ps(hy, y);
+            for (int lane = 0; lane < 8; ++lane) {
+                if (mask & (1 << lane)) {
+                    hitX[hits] = hx[lane];
+                    hitY[hits] = hy[lane];
+                    hits++;
+                }
+            }
+            y = _mm256_blendv_ps(y, _mm256_set1_ps(1.5f), hit);
+            x = _mm256_blendv_ps(x, _mm256_add_ps(_mm256_set1_ps(-2.5f), _mm256_mul_ps(unit8(s), _mm256_set1_ps(5.0f))), hit);
+            _mm256_storeu_ps(&r.x[i], x);
+        }
+        _mm256_storeu_ps(&r.y[i], y);
+    }
+    return hits + rainKernelScalar(i, end, hitX + hits, hitY + hits);
+}
+
+__attribute__((target("avx2")))
+void snowKernelAvx2(int begin, int end) {
+    SnowField& f = snowflakes;
+    int i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 y = _mm256_sub_ps(_mm256_loadu_ps(&f.y[i]), _mm256_loadu_ps(&f.speed[i]));
+        __m256 phase = _mm256_add_ps(_mm256_loadu_ps(&f.swayPhase[i]), _mm256_mul_ps(y, _mm256_set1_ps(2.0f)));
+        __m256 x = _mm256_add_ps(_mm256_loadu_ps(&f.x[i]), _mm256_mul_ps(sin8(phase), _mm256_set1_ps(0.001f)));
+
+        __m256i s = xorshift8(_mm256_loadu_si256((const __m256i*)&f.seed[i]));
+        _mm256_storeu_si256((__m256i*)&f.seed[i], s);
+
+        __m256 respawn = _mm256_cmp_ps(y, _mm256_set1_ps(-1.5f), _CMP_LT_OQ);
+        y = _mm256_blendv_ps(y, _mm256_set1_ps(1.5f), respawn);
+        x = _mm256_blendv_ps(x, _mm256_add_ps(_mm256_set1_ps(-3.0f), _mm256_mul_ps(unit8(s), _mm256_set1_ps(6.0f))), respawn);
+        _mm256_storeu_ps(&f.x[i], x);
+        _mm256_storeu_ps(&f.y[i], y);
+    }
+    snowKernelScalar(i, end);
+}
+
+#endif // WEATHER_SIMD
+
+void selectWeatherKernels() {
+    weatherKernelPath = KERNEL_SCALAR;
+#if WEATHER_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        weatherKernelPath = KERNEL_AVX2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        weatherKernelPath = KERNEL_SSE2;
+    }
+#endif
+    const char* names[] = { "scalar", "SSE2", "AVX2" };
+    printf("Weather kernels: %s\n", names[weatherKernelPath]);
+}
+
+void runLeafKernel(int begin, int end) {
+#if WEATHER_SIMD
+    if (weatherKernelPath == KERNEL_AVX2) { leafKernelAvx2(begin, end); return; }
+    if (weatherKernelPath == KERNEL_SSE2) { leafKernelSse2(begin, end); return; }
+#endif
+    leafKernelScalar(begin, end);
+}
+
+// Returns the number of drops that hit the ground; their positions are
+// written to rainHitX/rainHitY starting at index begin.
+int runRainKernel(int begin, int end) {
+    float* hitX = &rainHitX[begin];
+    float* hitY = &rainHitY[begin];
+#if WEATHER_SIMD
+    if (weatherKernelPath == KERNEL_AVX2) return rainKernelAvx2(begin, end, hitX, hitY);
+    if (weatherKernelPath == KERNEL_SSE2) return rainKernelSse2(begin, end, hitX, hitY);
+#endif
+    return rainKernelScalar(begin, end, hitX, hitY);
+}
+
+void runSnowKernel(int begin, int end) {
+#if WEATHER_SIMD
+    if (weatherKernelPath == KERNEL_AVX2) { snowKernelAvx2(begin, end); return; }
+    if (weatherKernelPath == KERNEL_SSE2) { snowKernelSse2(begin, end); return; }
+#endif
+    snowKernelScalar(begin, end);
+}
+
+// --- Procedural Rain Audio ---
+// Rain is synthesized in the mixer's music hook instead of looping an mp3.
+// Four noise lanes run side by side: lanes 0-1 are band-passed patter for the
+// left and right channels, lanes 2-3 are low-passed wind. The patter level
+// follows rainAudioLevel, and every ground hit the simulation reports fires a
+// short bright transient, so a monsoon sounds heavier than a drizzle. The SSE2
+// path and the scalar fallback share the same xorshift lanes and filters.
+
+const float RAIN_PATTER_GAIN = 0.12f;
+const float RAIN_SPLASH_GAIN = 0.35f;
+const float RAIN_WIND_GAIN = 0.30f;
+const float RAIN_SPLASH_DECAY = 0.995f;    // per sample, about 5 ms to a third
+const float RAIN_LEVEL_SMOOTHING = 0.0002f; // per sample, fades over ~0.1 s
+const float RAIN_AUDIO_MAX_LEVEL = 2.0f;
+const int RAIN_MIN_ONSET_SPACING = 8;         // average samples between splash onsets, at least
+
+struct RainSynth {
+    // Per-lane filter coefficients and state: band = lp1 - lp2 for patter,
+    // lp2 alone for wind.
+    alignas(16) float lp1Coeff[4] = { 0.70f, 0.70f, 0.012f, 0.012f };
+    alignas(16) float lp2Coeff[4] = { 0.05f, 0.05f, 0.020f, 0.020f };
+    alignas(16) float lp1[4] = {};
+    alignas(16) float lp2[4] = {};
+    alignas(16) uint32_t seed[4] = { 0x9E3779B9u, 0x85EBCA6Bu, 0xC2B2AE35u, 0x27D4EB2Fu };
+    uint32_t onsetSeed = 0x165667B1u;
+    float level = 0.0f;
+    float splash = 0.0f;
+    float gustPhase = 0.0f;
+    float gustStep = 0.0f;
+    bool sse2 = false;
+};
+RainSynth rainSynth;
+
+// Advances the per-sample controls (level, splash envelope, gusts) shared by
+// every lane and writes the four lane gains.
+inline void rainControlStep(RainSynth& r, float target, float onsetChance, float* gain) {
+    r.level += (target - r.level) * RAIN_LEVEL_SMOOTHING;
+    r.onsetSeed = kernelXorshift(r.onsetSeed);
+    if (kernelUnit(r.onsetSeed) < onsetChance) r.splash = 1.0f;
+    r.splash *= RAIN_SPLASH_DECAY;
+    r.gustPhase += r.gustStep;
+    if (r.gustPhase > TWO_PI) r.gustPhase -= TWO_PI;
+    float patter = r.level * (RAIN_PATTER_GAIN + r.splash * RAIN_SPLASH_GAIN);
+    float wind = r.level * RAIN_WIND_GAIN * (0.6f + 0.4f * kernelSinf(r.gustPhase));
+    gain[0] = gain[1] = patter;
+    gain[2] = gain[3] = wind;
+}
+
+// Converts one sample of four lanes to a stereo pair, given the lane gains.
+inline void rainMixLanes(const float* band, const float* low, const float* gain, float& left, float& right) {
+    left = band[0] * gain[0] + low[2] * gain[2];
+    right = band[1] * gain[1] + low[3] * gain[3];
+}
+
+inline short rainToSample(float v) {
+    v *= 32767.0f;
+    if (v > 32767.0f) v = 32767.0f;
+    if (v < -32768.0f) v = -32768.0f;
+    return (short)lrintf(v);
+}
+
+void rainSynthScalar(RainSynth& r, short* out, int frames, float target, float onsetChance) {
+    float band[4], gain[4];
+    for (int f = 0; f < frames; ++f) {
+        rainControlStep(r, target, onsetChance, gain);
+
+        for (int l = 0; l < 4; ++l) {
+            r.seed[l] = kernelXorshift(r.seed[l]);
+            float noise = kernelUnit(r.seed[l]) * 2.0f - 1.0f;
+            r.lp1[l] += r.lp1Coeff[l] * (noise - r.lp1[l]);
+            r.lp2[l] += r.lp2Coeff[l] * (r.lp1[l] - r.lp2[l]);
+            band[l] = r.lp1[l] - r.lp2[l];
+        }
+        float left, right;
+        rainMixLanes(band, r.lp2, gain, left, right);
+        out[2 * f] = rainToSample(left);
+        out[2 * f + 1] = rainToSample(right);
+    }
+}
+
+#if WEATHER_SIMD
+void rainSynthSse2(RainSynth& r, short* out, int frames, float target, float onsetChance) {
+    __m128 a1 = _mm_load_ps(r.lp1Coeff);
+    __m128 a2 = _mm_load_ps(r.lp2Coeff);
+    __m128 lp1 = _mm_load_ps(r.lp1);
+    __m128 lp2 = _mm_load_ps(r.lp2);
+    __m128i seed = _mm_load_si128((const __m128i*)r.seed);
+    const __m128 unit = _mm_set1_ps(RNG_UNIT * 2.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    alignas(16) float band[4], low[4], gain[4];
+
+    for (int f = 0; f < frames; ++f) {
+        rainControlStep(r, target, onsetChance, gain);
+
+        seed = _mm_xor_si128(seed, _mm_slli_epi32(seed, 13));
+        seed = _mm_xor_si128(seed, _mm_srli_epi32(seed, 17));
+        seed = _mm_xor_si128(seed, _mm_slli_epi32(seed, 5));
+        __m128 noise = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(seed, 8)), unit), one);
+        lp1 = _mm_add_ps(lp1, _mm_mul_ps(a1, _mm_sub_ps(noise, lp1)));
+        lp2 = _mm_add_ps(lp2, _mm_mul_ps(a2, _mm_sub_ps(lp1, lp2)));
+        _mm_store_ps(band, _mm_sub_ps(lp1, lp2));
+        _mm_store_ps(low, lp2);
+
+        float left, right;
+        rainMixLanes(band, low, gain, left, right);
+        out[2 * f] = rainToSample(left);
+        out[2 * f + 1] = rainToSample(right);
+    }
+    _mm_store_ps(r.lp1, lp1);
+    _mm_store_ps(r.lp2, lp2);
+    _mm_store_si128((__m128i*)r.seed, seed);
+}
+#endif // WEATHER_SIMD
+
+// Mix_HookMusic callback: fills the stream with rain for the current level and
+// the ground hits reported since the previous call. The mixer adds the bed
+// channels on top. Output is 16-bit stereo, checked in initAudio().
+void rainAudioCallback(void*, Uint8* stream, int len) {
+    short* out = (short*)stream;
+    int frames = len / (int)(2 * sizeof(short));
+    if (frames <= 0) return;
+
+    int hits = rainAudioHits.exchange(0, memory_order_relaxed);
+    float onsetChance = min((float)hits / frames, 1.0f / RAIN_MIN_ONSET_SPACING);
+    float target = rainAudioLevel.load(memory_order_relaxed);
+#if WEATHER_SIMD
+    if (rainSynth.sse2) { rainSynthSse2(rainSynth, out, frames, target, onsetChance); return; }
+#endif
+    rainSynthScalar(rainSynth, out, frames, target, onsetChance);
+}
+
+// --- Initialization Functions ---
+
+void initRain() {
+    randomFill(RNG_RAIN, raindrops.x, MAX_RAIN, -2.5f, 2.5f);
+    randomFill(RNG_RAIN, raindrops.y, MAX_RAIN, 1.5f, 3.5f);
+    randomFill(RNG_RAIN, raindrops.speed, MAX_RAIN, 0.02f, 0.04f);
+    for (int i = 0; i < MAX_RAIN; ++i) {
+        raindrops.seed[i] = makeKernelSeed(RNG_RAIN);
+    }
+}
+void initButterflies() {
+    for (int i = 0; i < MAX_BUTTERFLIES; ++i) {
+        Butterfly b;
+        b.x = -2.0f + randomFloat(RNG_BUTTERFLIES) * 4.0f;
+        b.y = -0.8f + randomFloat(RNG_BUTTERFLIES) * 0.4f;
+        b.prevX = b.x;
+        b.prevY = b.y;
+        b.initialY = b.y;
+        b.speed = 0.001f + randomFloat(RNG_BUTTERFLIES) * 0.002f;
+        b.directionAngle = randomFloat(RNG_BUTTERFLIES) * 2.0f * PI;
+        b.flutterPhase = randomFloat(RNG_BUTTERFLIES) * PI;
+        b.bobPhase = randomFloat(RNG_BUTTERFLIES) * PI;
+
+        int colorType = randomInt(RNG_BUTTERFLIES, 3);
+        if (colorType == 0) { b.r = 1.0f; b.g = 0.8f; b.b = 0.2f; } // Yellow
+        else if (colorType == 1) { b.r = 0.5f; b.g = 0.7f; b.b = 1.0f; } // Blue
+        else { b.r = 1.0f; b.g = 0.6f; b.b = 0.8f; } // Pink
+
+        butterflies.push_back(b);
+    }
+}
+
+void initFireflies() {
+    fireflies.clear();
+    for (int i = 0; i < MAX_FIREFLIES; ++i) {
+        Firefly f;
+
+        f.x = -2.5f + randomFloat(RNG_FIREFLIES) * 5.0f;
+        // Confine them to the ground and lower tree area
+        f.y = -0.8f + randomFloat(RNG_FIREFLIES) * 0.6f;
+        f.z = -0.5f + randomFloat(RNG_FIREFLIES) * 1.0f;
+
+        f.initialY = f.y;
+        f.speed = 0.0005f + randomFloat(RNG_FIREFLIES) * 0.001f;
+        f.glowPhase = randomFloat(RNG_FIREFLIES) * PI;
+        f.movePhaseX = randomFloat(RNG_FIREFLIES) * PI * 2;
+        f.movePhaseY = randomFloat(RNG_FIREFLIES) * PI * 2;
+        fireflies.push_back(f);
+    }
+}
+
+
+void initLeaves() {
+    float y_offset = -0.1f;
+    for (int i = 0; i < LEAF_COUNT; ++i) {
+        leaves.x[i] = -0.6f + randomFloat(RNG_LEAVES) * 1.2f;
+        leaves.y[i] = (0.0f + y_offset) + randomFloat(RNG_LEAVES) * 0.8f;
+        leaves.size[i] = 0.8f + randomFloat(RNG_LEAVES);
+        leaves.speed[i] = 0.001f + randomFloat(RNG_LEAVES) * 0.001f;
+        leaves.sway[i] = randomFloat(RNG_LEAVES) * 2.0f - 1.0f;
+        leaves.swaySpeed[i] = 0.01f + randomFloat(RNG_LEAVES) * 0.02f;
+        leaves.rotation[i] = randomFloat(RNG_LEAVES) * 360.0f;
+        leaves.rotationSpeed[i] = randomFloat(RNG_LEAVES) * 2.0f - 1.0f;
+        float green_base = 0.4f + randomFloat(RNG_LEAVES) * 0.4f;
+        float red_comp = 0.1f + randomFloat(RNG_LEAVES) * 0.15f;
+        float blue_comp = 0.2f + randomFloat(RNG_LEAVES) * 0.1f;
+        leaves.r[i] = red_comp; leaves.g[i] = green_base; leaves.b[i] = blue_comp;
+        leaves.seed[i] = makeKernelSeed(RNG_LEAVES);
+    }
+}
+
+void initSnow() {
+    randomFill(RNG_SNOW, snowflakes.x, MAX_SNOW, -3.0f, 3.0f);
+    randomFill(RNG_SNOW, snowflakes.y, MAX_SNOW, -1.5f, 1.5f); // Scatter them all over
+    randomFill(RNG_SNOW, snowflakes.size, MAX_SNOW, 0.003f, 0.008f);
+    randomFill(RNG_SNOW, snowflakes.speed, MAX_SNOW, 0.001f, 0.002f);
+    randomFill(RNG_SNOW, snowflakes.swayPhase, MAX_SNOW, 0.0f, PI * 2.0f);
+    for (int i = 0; i < MAX_SNOW; ++i) {
+        snowflakes.seed[i] = makeKernelSeed(RNG_SNOW);
+    }
+}
+
+void initElves() {
+    for(int i = 0; i < ELF_COUNT; ++i) {
+        elves[i].x = -1.8f + randomFloat(RNG_ELVES) * 3.6f;
+        elves[i].y = -0.7f;
+        elves[i].targetX = elves[i].x;
+        elves[i].speed = 0.001f + randomFloat(RNG_ELVES) * 0.001f;
+        elves[i].state = ELF_IDLE;
+        elves[i].stateTimer = 2.0f + randomFloat(RNG_ELVES) * 3.0f; // Idle for 2-5 seconds
+        elves[i].animationPhase = 0.0f;
+
+        if (i % 3 == 0) { elves[i].r = 0.8f; elves[i].g = 0.1f; elves[i].b = 0.2f; } // Red tunic
+        else if (i % 3 == 1) { elves[i].r = 0.1f; elves[i].g = 0.2f; elves[i].b = 0.8f; } // Blue tunic
+        else { elves[i].r = 0.1f; elves[i].g = 0.6f; elves[i].b = 0.3f; } // Green tunic
+    }
+}
+
+void initStars() {
+    for (int i = 0; i < STAR_COUNT; ++i) {
+        stars[i].x = -2.5f + randomFloat(RNG_STARS) * 5.0f;
+        stars[i].y = randomFloat(RNG_STARS) * 1.5f;
+        stars[i].radius = 0.002f + randomFloat(RNG_STARS) * 0.004f;
+        stars[i].twinkleSpeed = 0.5f + randomFloat(RNG_STARS) * 1.5f;
+        stars[i].initialPhase = randomFloat(RNG_STARS) * PI * 2.0f;
+    }
+}
+
+void initBirds() {
+    for (int i = 0; i < MAX_BIRDS; i++) {
+        birds[i].startX = -3.0f - randomFloat(RNG_BIRDS) * 5.0f;
+        birds[i].y = 0.8f + randomFloat(RNG_BIRDS) * 0.6f;
+        birds[i].startTick = simTick;
+        birds[i].speed = 0.006f + randomFloat(RNG_BIRDS) * 0.004f;
+        birds[i].startPhase = randomFloat(RNG_BIRDS) * 3.14159f;
+    }
+}
+
+
+void initClouds() {
+    float section_width = 8.0f / CLOUD_COUNT;
+
+    for (int i = 0; i < CLOUD_COUNT; ++i) {
+        // --- Basic Cloud Properties ---
+        clouds[i].x = -4.0f + i * section_width + (randomFloat(RNG_CLOUDS) - 0.5f) * section_width;
+        clouds[i].y = 0.6f + randomFloat(RNG_CLOUDS) * 0.7f;
+        clouds[i].speed = (0.001f + randomFloat(RNG_CLOUDS) * 0.0015f) * 2.0f;
+
+
+        clouds[i].circles[0].radius = (0.12f + randomFloat(RNG_CLOUDS) * 0.03f);
+        clouds[i].circles[0].yScale = 0.5f;
+
+
+        int num_puffs = 5 + randomInt(RNG_CLOUDS, 6);
+        clouds[i].num_circles = num_puffs + 1;
+
+        for (int j = 1; j <= num_puffs; j++) {
+            CloudCircle& c = clouds[i].circles[j];
+
+            c.x_offset = ( randomFloat(RNG_CLOUDS) - 0.5f ) * clouds[i].circles[0].radius * 1.8f;
+            c.y_offset = ( randomFloat(RNG_CLOUDS) * 0.5f ) * clouds[i].circles[0].radius;
+
+            c.radius = clouds[i].circles[0].radius * (0.4f + randomFloat(RNG_CLOUDS) * 0.5f);
+            c.yScale = 1.0f;
+        }
+    }
+}
+
+
+// Puts every simulated element back in its starting state, drawing from
+// freshly seeded random streams, so runs with the same sceneSeed match.
+void resetScene() {
+    seedRandomStreams(sceneSeed);
+    simTick = 0;
+    simAccumulator = 0.0;
+    renderAlpha = 1.0f;
+    dayNightPhase = 0.1f;
+    crystalGlow = 0.0f;
+    riverFlowOffset = 0.0f;
+    currentWeather = SUNNY;
+    snowCoverage = 0.0f;
+    riverFreezeAmount = 0.0f;
+    rainCount = RAIN_COUNT;
+    snowCount = SNOW_COUNT;
+    butterflies.clear();
+    fireflies.clear();
+    puddles.clear();
+    rebuildPuddleGrid();
+    rainLandingCount = 0;
+    splashes.clear();
+    droplets.clear();
+    campfires.clear();
+
+    initParticles();
+    initLeaves();
+    initElves();
+    initStars();
+    initClouds();
+    initBirds();
+    initRain();
+    initButterflies();
+    initFireflies();
+    initSnow();
+
+    // Initialize campfire
+    campfires.push_back({-1.5f, -0.6f});
+    if (!campfires.empty()) {
+        campfires[0].flamePhase1 = 0.0f;
+        campfires[0].flamePhase2 = PI / 2.0f;
+    }
+
+    // Initialize Fox
+    fox.speed = 0.05f;
+    fox.pausedTicks = 0;
+    storePreviousPositions();
+    publishSnapshot();
+}
+
+void initSceneElements() {
+    if (!sceneSeedFixed) sceneSeed = static_cast<uint64_t>(time(nullptr));
+    printf("Scene seed: %llu\n", (unsigned long long)sceneSeed);
+    initUnitCircle();
+    initLightingLut();
+    loadSceneLayout();
+    selectWeatherKernels();
+    initJobSystem();
+    resetScene();
+
+    glClearColor(0.6f, 0.8f, 1.0f, 1.0f);
+}
+// --- Update Functions ---
+
+void updateElves() {
+    TimeMoment tm = timeMomentAt(dayNightPhase);
+    if (tm == NIGHT || currentWeather == RAINY || currentWeather == SNOWY) return;
+
+    for(int i = 0; i < ELF_COUNT; ++i) {
+        elves[i].stateTimer -= SIM_DT; // Decrease timer
+
+        if (elves[i].stateTimer <= 0) {
+            if (elves[i].state == ELF_IDLE) {
+                // Switch to walking
+                elves[i].state = ELF_WALKING;
+                elves[i].stateTimer = 5.0f + randomFloat(RNG_ELVES) * 5.0f; // Walk for 5-10 seconds
+                // Pick a new target
+                elves[i].targetX = -1.8f + randomFloat(RNG_ELVES) * 3.6f;
+            } else {
+                // Switch to idle
+                elves[i].state = ELF_IDLE;
+                elves[i].stateTimer = 2.0f + randomFloat(RNG_ELVES) * 3.0f; // Idle for 2-5 seconds
+            }
+        }
+
+        if (elves[i].state == ELF_WALKING) {
+            // Move towards target
+            if (elves[i].x < elves[i].targetX) {
+                elves[i].x += elves[i].speed;
+            } else {
+                 elves[i].x -= elves[i].speed;
+            }
+            elves[i].animationPhase += 0.2f; // Update animation phase
+        }
+    }
+}
+
+void updateButterflies() {
+
+    if (currentWeather == RAINY || currentWeather == SNOWY) {
+        if (!butterflies.empty()) {
+            butterflies.clear();
+        }
+        return;
+    }
+
+
+    if (butterflies.empty()) {
+        initButterflies();
+    }
+
+    for (auto& b : butterflies) {
+        b.x += cosf(b.directionAngle) * b.speed;
+        // Bobbing motion
+        b.y = b.initialY + 0.05f * sinf(b.bobPhase);
+
+        b.flutterPhase += 0.3f;
+        b.bobPhase += 0.05f;
+
+        // Occasionally change direction
+        if (randomInt(RNG_BUTTERFLIES, 100) == 0) {
+            b.directionAngle += (randomFloat(RNG_BUTTERFLIES) - 0.5f);
+        }
+
+        // Wrap around screen edges
+        if (b.x > 2.7f) b.x = -2.7f;
+        if (b.x < -2.7f) b.x = 2.7f;
+    }
+}
+
+
+
+// Crossfades to the current weather's soundscape. Beds leaving the mix fade
+// out and beds joining it fade in over AUDIO_CROSSFADE_MS; a bed shared by
+// both soundscapes keeps playing untouched. Nothing is decoded here, and the
+// call returns immediately unless currentWeather changed since the last one.
+void updateAudio() {
+    if (!audioReady || audioWeather == currentWeather) return;
+    unsigned wanted = soundscapeBeds[currentWeather];
+
+    for (int bed = 0; bed < AUDIO_BED_COUNT; bed++) {
+        if (!audioBeds[bed]) continue;
+        bool playing = Mix_Playing(bed) && Mix_FadingChannel(bed) != MIX_FADING_OUT;
+        if (wanted & (1u << bed)) {
+            if (!playing) Mix_FadeInChannel(bed, audioBeds[bed], -1, AUDIO_CROSSFADE_MS);
+        } else if (playing) {
+            Mix_FadeOutChannel(bed, AUDIO_CROSSFADE_MS);
+        }
+    }
+    audioWeather = currentWeather;
+}
+
+void updateFireflies() {
+
+    if (timeMomentAt(dayNightPhase) != NIGHT || currentWeather == RAINY || currentWeather == SNOWY) {
+        if (!fireflies.empty()) {
+            fireflies.clear();
+        }
+        return;
+    }
+
+
+    if (fireflies.empty()) {
+        initFireflies();
+    }
+
+    for (auto& f : fireflies) {
+        f.movePhaseX += 0.03f * f.speed * 100;
+        f.movePhaseY += 0.02f * f.speed * 100;
+
+        f.x += cosf(f.movePhaseX) * 0.001f;
+        f.y += sinf(f.movePhaseY) * 0.0005f;
 
         f.glowPhase += 0.1f;
 
@@ -2350,98 +4819,141 @@ void updateFireflies() {
 }
 
 void updateRainAndSplashes() {
+    rainLandingCount = 0;
+    // Independent drops add up incoherently, so loudness grows with the square
+    // root of the drop count; capped so the monsoon preset doesn't clip.
+    float audioLevel = min(sqrtf((float)rainCount / RAIN_COUNT), RAIN_AUDIO_MAX_LEVEL);
+    rainAudioLevel.store(currentWeather == RAINY ? audioLevel : 0.0f, memory_order_relaxed);
     if (currentWeather != RAINY) {
         splashes.clear();
         droplets.clear();
         return;
     }
 
-    // Update raindrops
-    for (int i = 0; i < RAIN_COUNT; ++i) {
-        raindrops[i].y -= raindrops[i].speed;
+    // Update raindrops in parallel chunks; each chunk reports where its drops
+    // hit the ground, starting at the chunk's first index in rainHitX/rainHitY
+    static int chunkHits[MAX_JOB_CHUNKS];
+    int chunkSize = jobChunkSize(rainCount, 1024);
+    parallelFor(0, rainCount, chunkSize, [](int chunk, int b, int e) {
+        chunkHits[chunk] = runRainKernel(b, e);
+    });
 
+    for (int first = 0, chunk = 0; first < rainCount; first += chunkSize, ++chunk) {
+        for (int h = first; h < first + chunkHits[chunk]; ++h) {
+            rainLandingX[rainLandingCount++] = rainHitX[h];
 
-        if (raindrops[i].y < -1.1f) {
             // Create the expanding ring (puddle)
-            splashes.push_back({raindrops[i].x, raindrops[i].y, 0.0f, 0.1f, 1.0f});
+            splashes.push_back({rainHitX[h], rainHitY[h], 0.0f, 0.1f, 1.0f});
 
 
             for (int j = 0; j < 5; ++j) {
-                float angle = (rand() / (float)RAND_MAX) * PI; // Upward arc
-                float speed = 0.01f + (rand() / (float)RAND_MAX) * 0.02f;
+                float angle = randomFloat(RNG_SPLASHES) * PI; // Upward arc
+                float speed = 0.01f + randomFloat(RNG_SPLASHES) * 0.02f;
+                float life = 0.5f + randomFloat(RNG_SPLASHES) * 0.5f; // Lifetime
                 droplets.push_back({
-                    raindrops[i].x,
-                    raindrops[i].y,
+                    rainHitX[h],
+                    rainHitY[h],
                     cosf(angle) * speed * 0.5f, // Horizontal velocity
                     sinf(angle) * speed,       // Vertical velocity
-                    0.5f + (rand() / (float)RAND_MAX) * 0.5f // Lifetime
+                    life
                 });
             }
-
-            // Reset the raindrop
-            raindrops[i].y = 1.5f;
-            raindrops[i].x = -2.5f + (rand() / (float)RAND_MAX) * 5.0f;
-        } else if (raindrops[i].y < -1.5f) {
-            raindrops[i].y = 1.5f;
-            raindrops[i].x = -2.5f + (rand() / (float)RAND_MAX) * 5.0f;
         }
     }
 
-    // Update expanding ring splashes
-    for (size_t i = 0; i < splashes.size(); ) {
-        splashes[i].life -= 0.05f;
-        splashes[i].radius += 0.005f;
-        if (splashes[i].life <= 0) {
-            splashes.erase(splashes.begin() + i);
-        } else {
-            i++;
-        }
+    // Update expanding ring splashes, compacting the live ones to the front
+    int liveSplashes = 0;
+    for (int i = 0; i < splashes.count; ++i) {
+        Splash splash = splashes.items[i];
+        splash.life -= 0.05f;
+        splash.radius += 0.005f;
+        if (splash.life > 0) splashes.items[liveSplashes++] = splash;
+    }
+    splashes.count = liveSplashes;
+    if (rainAudioHooked.load(memory_order_relaxed)) {
+        rainAudioHits.fetch_add(rainLandingCount, memory_order_relaxed);
     }
 
 
     float gravity = 0.08f;
-    for (size_t i = 0; i < droplets.size(); ) {
-        droplets[i].life -= 0.02f;
-        droplets[i].vy -= gravity * 0.016f; // Apply gravity
-        droplets[i].x += droplets[i].vx;
-        droplets[i].y += droplets[i].vy;
-        if (droplets[i].life <= 0) {
-            droplets.erase(droplets.begin() + i);
-        } else {
-            i++;
-        }
+    int liveDroplets = 0;
+    for (int i = 0; i < droplets.count; ++i) {
+        Droplet droplet = droplets.items[i];
+        droplet.life -= 0.02f;
+        droplet.vy -= gravity * SIM_DT; // Apply gravity
+        droplet.x += droplet.vx;
+        droplet.y += droplet.vy;
+        if (droplet.life > 0) droplets.items[liveDroplets++] = droplet;
     }
+    droplets.count = liveDroplets;
 }
 
 
-void updatePuddles(float dt) {
+int puddleCell(float x, float y) {
+    int col = (int)((x - PUDDLE_GRID_X0) / PUDDLE_CELL_WIDTH);
+    int row = (int)((y - PUDDLE_GRID_Y0) / PUDDLE_CELL_HEIGHT);
+    col = max(0, min(PUDDLE_GRID_COLS - 1, col));
+    row = max(0, min(PUDDLE_GRID_ROWS - 1, row));
+    return row * PUDDLE_GRID_COLS + col;
+}
 
-    if (currentWeather == RAINY && (rand() % 150 == 0) && puddles.size() < 15) {
-        for (int attempt = 0; attempt < 10; ++attempt) {
-            float candidateX = -2.0f + (rand() / (float)RAND_MAX) * 4.0f;
-            float candidateY = -0.8f + (rand() / (float)RAND_MAX) * 0.7f;
-            float candidateMaxRadius = 0.1f + (rand() / (float)RAND_MAX) * 0.2f;
-
-            bool overlaps = false;
-            for (const auto& p : puddles) {
-                float dx = p.x - candidateX;
-                float dy = p.y - candidateY;
-                float distance = sqrt(dx*dx + dy*dy);
-                if (distance < p.maxRadius + candidateMaxRadius) {
-                    overlaps = true;
-                    break;
-                }
-            }
+void insertPuddleInGrid(int i) {
+    int cell = puddleCell(puddles[i].x, puddles[i].y);
+    puddleNext[i] = puddleCellHead[cell];
+    puddleCellHead[cell] = i;
+}
 
-            if (!overlaps) {
-                puddles.push_back({candidateX, candidateY, 0.0f, candidateMaxRadius, PUDDLE_GROWING, 0.0f});
-                break;
+void rebuildPuddleGrid() {
+    for (int& head : puddleCellHead) head = -1;
+    for (int i = 0; i < puddles.size(); ++i) insertPuddleInGrid(i);
+}
+
+// Returns a puddle whose footprint, widened by `radius`, contains (x, y), or
+// -1. Footprints use the full-grown radius and are squashed by PUDDLE_Y_SCALE.
+int findPuddleNear(float x, float y, float radius) {
+    int center = puddleCell(x, y);
+    int centerCol = center % PUDDLE_GRID_COLS, centerRow = center / PUDDLE_GRID_COLS;
+    for (int row = max(0, centerRow - 1); row <= min(PUDDLE_GRID_ROWS - 1, centerRow + 1); ++row) {
+        for (int col = max(0, centerCol - 1); col <= min(PUDDLE_GRID_COLS - 1, centerCol + 1); ++col) {
+            for (int i = puddleCellHead[row * PUDDLE_GRID_COLS + col]; i >= 0; i = puddleNext[i]) {
+                const Puddle& p = puddles[i];
+                float dx = p.x - x;
+                float dy = (p.y - y) / PUDDLE_Y_SCALE;
+                float reach = p.maxRadius + radius;
+                if (dx * dx + dy * dy < reach * reach) return i;
             }
         }
     }
+    return -1;
+}
+
+// Starts a puddle at (x, y) unless it would overlap one or the pool is full.
+bool tryAddPuddle(float x, float y, float maxRadius) {
+    if (puddles.size() >= MAX_PUDDLES || findPuddleNear(x, y, maxRadius) >= 0) return false;
+    puddles.push_back({x, y, 0.0f, maxRadius, PUDDLE_GROWING, 0.0f});
+    insertPuddleInGrid(puddles.size() - 1);
+    return true;
+}
+
+void updatePuddles(float dt) {
 
+    // Each raindrop that reached the ground lands at a random depth on it: in
+    // a puddle it feeds the puddle, elsewhere it may start a new one.
+    if (currentWeather == RAINY) {
+        for (int h = 0; h < rainLandingCount; ++h) {
+            float x = rainLandingX[h];
+            float y = -0.8f + randomFloat(RNG_PUDDLES) * 0.7f;
+            int hit = findPuddleNear(x, y, 0.0f);
+            if (hit >= 0) {
+                Puddle& p = puddles[hit];
+                if (p.state == PUDDLE_GROWING) p.currentRadius = min(p.currentRadius + 0.002f, p.maxRadius);
+            } else if (x > -2.0f && x < 2.0f && randomInt(RNG_PUDDLES, 20) == 0) {
+                tryAddPuddle(x, y, PUDDLE_MIN_RADIUS + randomFloat(RNG_PUDDLES) * (PUDDLE_MAX_RADIUS - PUDDLE_MIN_RADIUS));
+            }
+        }
+    }
 
-    for (size_t i = 0; i < puddles.size(); ) {
+    for (int i = 0; i < puddles.size(); ) {
         bool shouldBeRemoved = false;
 
         if (currentWeather == RAINY) {
@@ -2498,340 +5010,1374 @@ void updatePuddles(float dt) {
         }
 
         if (shouldBeRemoved) {
-            puddles.erase(puddles.begin() + i);
+            puddles[i] = puddles.back();
+            puddles.pop_back();
+        } else {
+            i++;
+        }
+    }
+
+    rebuildPuddleGrid();
+}
+
+// Steps of `step` until `amount` is used up, as the per-tick loops count them.
+long long ticksToCover(float amount, float step) {
+    return amount > 0.0f ? (long long)ceilf(amount / step) : 0;
+}
+
+// Advances one puddle by `ticks` steps of the current weather in closed form,
+// following updatePuddles()' state machine through every state change the
+// span covers. Returns false if the puddle dried up.
+bool advancePuddle(Puddle& p, long long ticks, float dt) {
+    const float radiusStep = 0.0005f;
+    const float freezeStep = dt * 2.0f;
+
+    if (currentWeather == RAINY) {
+        if (p.state == PUDDLE_FROZEN) p.state = PUDDLE_MELTING;
+        if (p.state == PUDDLE_GROWING) {
+            long long growing = ticksToCover(p.maxRadius - p.currentRadius, radiusStep);
+            p.currentRadius += radiusStep * min(ticks, growing);
+            if (ticks > growing) p.state = PUDDLE_FULL;
+        }
+        if (p.state == PUDDLE_MELTING) {
+            if (ticks >= max(1LL, ticksToCover(p.freezeProgress, freezeStep))) {
+                p.freezeProgress = 0.0f;
+                p.state = PUDDLE_FULL;
+            } else {
+                p.freezeProgress -= freezeStep * ticks;
+            }
+        }
+    } else if (currentWeather == SNOWY) {
+        if (p.state == PUDDLE_GROWING || p.state == PUDDLE_FULL) p.state = PUDDLE_FREEZING;
+        if (p.state == PUDDLE_FREEZING) {
+            if (ticks >= max(1LL, ticksToCover(1.0f - p.freezeProgress, freezeStep))) {
+                p.freezeProgress = 1.0f;
+                p.state = PUDDLE_FROZEN;
+            } else {
+                p.freezeProgress += freezeStep * ticks;
+            }
+        }
+    } else {
+        if (p.state == PUDDLE_FROZEN) p.state = PUDDLE_MELTING;
+        if (p.state == PUDDLE_GROWING || p.state == PUDDLE_FULL) p.state = PUDDLE_SHRINKING;
+        if (p.state == PUDDLE_MELTING) {
+            long long melting = max(1LL, ticksToCover(p.freezeProgress, freezeStep));
+            if (ticks < melting) {
+                p.freezeProgress -= freezeStep * ticks;
+                return true;
+            }
+            // The step that finishes melting also starts shrinking
+            p.freezeProgress = 0.0f;
+            p.state = PUDDLE_SHRINKING;
+            ticks -= melting - 1;
+        }
+        if (p.state == PUDDLE_SHRINKING) {
+            if (ticks >= max(1LL, ticksToCover(p.currentRadius, radiusStep))) return false;
+            p.currentRadius -= radiusStep * ticks;
+        }
+    }
+    return true;
+}
+
+void advancePuddles(long long ticks) {
+    for (int i = 0; i < puddles.size(); ) {
+        if (advancePuddle(puddles[i], ticks, SIM_DT)) {
+            i++;
+        } else {
+            puddles[i] = puddles.back();
+            puddles.pop_back();
+        }
+    }
+    rebuildPuddleGrid();
+}
+
+
+// Restarts every bird whose flight has passed the right edge by now, at the
+// tick it crossed, with a new height and speed. While the birds are hidden
+// this task is suspended; the first step after they reappear catches up on
+// all the wraps they missed.
+void updateBirds() {
+    for (int i = 0; i < MAX_BIRDS; i++) {
+        Bird& b = birds[i];
+        for (long long wrap = birdWrapTick(b); wrap <= simTick; wrap = birdWrapTick(b)) {
+            b.startPhase = birdPhaseAt(b, (double)wrap);
+            b.startX = -3.0f;
+            b.startTick = wrap;
+            b.y = 0.8f + randomFloat(RNG_BIRDS) * 0.6f;
+            b.speed = 0.006f + randomFloat(RNG_BIRDS) * 0.004f;
+        }
+    }
+}
+
+void updateLeaves() {
+    if (currentWeather == SNOWY) return;
+
+    runLeafKernel(0, LEAF_COUNT);
+}
+
+void updateSnow() {
+    if (currentWeather != SNOWY) return;
+
+    parallelFor(0, snowCount, jobChunkSize(snowCount, 2048), [](int, int b, int e) {
+        runSnowKernel(b, e);
+    });
+}
+
+void drawParticles() {
+    glPushAttrib(GL_ENABLE_BIT);
+    glDisable(GL_LIGHTING);
+    glEnable(GL_BLEND);
+    glPointSize(3.0f);
+
+    // Draw Sparks and Embers (Points)
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE); // Additive blending for glows
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    for (ParticleType type : {SPARK, EMBER}) {
+        const ParticleView& s = view.particles[type];
+        if (s.count == 0) continue;
+        glVertexPointer(2, GL_FLOAT, 0, s.xy);
+        glColorPointer(4, GL_FLOAT, 0, s.rgba);
+        glDrawArrays(GL_POINTS, 0, s.count);
+    }
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+
+    // Draw Smoke (Circles, standard transparency)
+    const ParticleView& smoke = view.particles[SMOKE];
+    for (int i = 0; i < smoke.count; ++i) {
+        const float* c = &smoke.rgba[i * 4];
+        submitCircle(BLEND_ALPHA, smoke.xy[i * 2], smoke.xy[i * 2 + 1], smoke.size[i], 1.0f, c[0], c[1], c[2], c[3]);
+    }
+    flushRenderQueue();
+
+    glPopAttrib();
+}
+
+void initParticles() {
+    for (int type = 0; type < PARTICLE_TYPE_COUNT; ++type) {
+        particleStreams[type].count = 0;
+        particleStreams[type].recycleCursor = 0;
+    }
+    particleStreams[SPARK].opacity = 1.0f;
+    particleStreams[EMBER].opacity = 1.0f;
+    particleStreams[SMOKE].opacity = 0.4f;
+}
+
+void emitParticle(ParticleType type, float x, float y, float vx, float vy, float life, float maxLife,
+                  float size, float r, float g, float b, float originY) {
+    ParticleStream& s = particleStreams[type];
+
+    int i;
+    if (s.count < MAX_PARTICLES) {
+        i = s.count++;
+    } else {
+        // Stream is full: recycle slots in ring order instead of dropping the particle
+        i = s.recycleCursor;
+        s.recycleCursor = (s.recycleCursor + 1) % MAX_PARTICLES;
+    }
+
+    s.xy[i * 2] = x;      s.xy[i * 2 + 1] = y;
+    s.vxy[i * 2] = vx;    s.vxy[i * 2 + 1] = vy;
+    s.life[i] = life;
+    s.maxLife[i] = maxLife;
+    s.size[i] = size;
+    s.originY[i] = originY;
+    s.rgba[i * 4] = r;    s.rgba[i * 4 + 1] = g;    s.rgba[i * 4 + 2] = b;
+    s.rgba[i * 4 + 3] = s.opacity;
+}
+
+// O(1) removal: the last particle in the stream is moved into slot i.
+void removeParticle(ParticleStream& s, int i) {
+    int last = --s.count;
+    if (i == last) return;
+
+    s.xy[i * 2] = s.xy[last * 2];       s.xy[i * 2 + 1] = s.xy[last * 2 + 1];
+    s.vxy[i * 2] = s.vxy[last * 2];     s.vxy[i * 2 + 1] = s.vxy[last * 2 + 1];
+    s.life[i] = s.life[last];
+    s.maxLife[i] = s.maxLife[last];
+    s.size[i] = s.size[last];
+    s.originY[i] = s.originY[last];
+    for (int k = 0; k < 4; ++k) s.rgba[i * 4 + k] = s.rgba[last * 4 + k];
+}
+
+void updateParticleStream(ParticleType type, float dt) {
+    ParticleStream& s = particleStreams[type];
+
+    for (int i = 0; i < s.count; ) {
+        s.life[i] -= dt;
+        if (s.life[i] <= 0) {
+            removeParticle(s, i);
         } else {
             i++;
         }
     }
+
+    if (type == SPARK) {
+        for (int i = 0; i < s.count; ++i) {
+            s.vxy[i * 2 + 1] -= 0.0003f;
+        }
+    } else if (type == EMBER) {
+        for (int i = 0; i < s.count; ++i) {
+            s.vxy[i * 2] *= 0.98f;
+            s.vxy[i * 2 + 1] -= 0.00005f;
+        }
+    } else if (type == SMOKE) {
+        for (int i = 0; i < s.count; ++i) {
+            s.size[i] += dt * 0.05f;
+            s.vxy[i * 2] *= 0.99f;
+            s.vxy[i * 2 + 1] *= 1.005f;
+        }
+    }
+
+    for (int i = 0; i < s.count * 2; ++i) {
+        s.xy[i] += s.vxy[i];
+    }
+
+    // Fade out over the particle's lifetime
+    for (int i = 0; i < s.count; ++i) {
+        float alpha = s.life[i] / s.maxLife[i];
+        if (type == SMOKE) {
+            // Smoke also fades as it rises above the fire
+            alpha *= (1.0f - (s.xy[i * 2 + 1] - s.originY[i]) / 0.5f);
+            if (alpha < 0) alpha = 0;
+        }
+        s.rgba[i * 4 + 3] = alpha * s.opacity;
+    }
+}
+
+void updateParticles(float dt) {
+    // --- Emit New Particles ---
+
+    if (currentWeather != RAINY && currentWeather != SNOWY) {
+        for (const auto& fire : campfires) {
+            // Sparks
+            if (randomInt(RNG_PARTICLES, 4) == 0) {
+                emitParticle(SPARK, fire.x, fire.y + 0.05f, (randomInt(RNG_PARTICLES, 100)-50)/8000.f, 0.002f, 0.2f, 0.2f, 0.f,
+                             1.0f, 0.8f, 0.2f, fire.y);
+            }
+            // Embers
+            if (randomInt(RNG_PARTICLES, 15) == 0) {
+                emitParticle(EMBER, fire.x, fire.y, (randomInt(RNG_PARTICLES, 100)-50)/3000.f, 0.002f, 0.4f, 0.4f, 0.f,
+                             1.0f, 0.4f, 0.0f, fire.y);
+            }
+            // Smoke
+            if (randomInt(RNG_PARTICLES, 5) == 0) {
+                float initialSmokeRadius = 0.01f;
+                float initialSmokeVY = 0.003f + randomFloat(RNG_PARTICLES) * 0.002f;
+                emitParticle(SMOKE, fire.x + (-0.01f + randomFloat(RNG_PARTICLES) * 0.02f), fire.y + 0.08f,
+                             (-0.0005f + randomFloat(RNG_PARTICLES) * 0.001f), initialSmokeVY,
+                             2.0f + randomFloat(RNG_PARTICLES) * 1.0f, 3.0f, initialSmokeRadius,
+                             0.8f, 0.8f, 0.8f, fire.y);
+            }
+        }
+    }
+
+    for (int type = 0; type < PARTICLE_TYPE_COUNT; ++type) {
+        updateParticleStream(static_cast<ParticleType>(type), dt);
+    }
+}
+
+// Copies the positions that display() interpolates between.
+void storePreviousPositions() {
+    for (int i = 0; i < ELF_COUNT; ++i) elves[i].prevX = elves[i].x;
+    for (auto& b : butterflies) { b.prevX = b.x; b.prevY = b.y; }
+}
+
+// Day phase, fire and crystal phases, snow cover and the river: the
+// RES_SCENE state the other simulation tasks read. Melting snow can also
+// leave puddles.
+void updateSceneState() {
+    dayNightPhase += DAY_PHASE_PER_TICK;
+    if (dayNightPhase > 1.0f) dayNightPhase = 0.0f;
+
+    crystalGlow += CRYSTAL_GLOW_PER_TICK;
+
+
+    if (!campfires.empty()) {
+        for (auto& fire : campfires) {
+            fire.flamePhase1 += 0.1f;
+            fire.flamePhase2 += 0.07f;
+        }
+
+
+        // ---  Update Snow Coverage based on Weather ---
+    if (currentWeather == SNOWY) {
+        if (snowCoverage < 1.0f) {
+            snowCoverage += 0.0015f; // Snow slowly accumulates
+        }
+    } else if (currentWeather == RAINY) {
+        if (snowCoverage > 0.0f) {
+            snowCoverage -= 0.002f; // Rain melts snow faster
+            // Chance to turn melting snow into a puddle
+            if (randomInt(RNG_PUDDLES, 100) == 0) {
+                float x = -2.0f + randomFloat(RNG_PUDDLES) * 4.0f;
+                float y = -0.8f + randomFloat(RNG_PUDDLES) * 0.7f;
+                tryAddPuddle(x, y, 0.06f + randomFloat(RNG_PUDDLES) * (PUDDLE_MAX_RADIUS - 0.06f));
+            }
+        }
+    } else { // Sunny
+        if (snowCoverage > 0.0f) {
+            snowCoverage -= 0.003f; // Sun melts snow slowly
+        }
+    }
+    // Clamp the value between 0 and 1
+    if (snowCoverage < 0.0f) snowCoverage = 0.0f;
+    if (snowCoverage > 1.0f) snowCoverage = 1.0f;
+
+    }
+
+   // ---  Update River Freeze/Melt ---
+    if (currentWeather == SNOWY) {
+        if (riverFreezeAmount < 1.0f) riverFreezeAmount += 0.0025f;
+    } else {
+        if (riverFreezeAmount > 0.0f) riverFreezeAmount -= 0.0025f;
+    }
+    if (riverFreezeAmount > 1.0f) riverFreezeAmount = 1.0f;
+    if (riverFreezeAmount < 0.0f) riverFreezeAmount = 0.0f;
+
+    // --- River Flow Speed now depends on how frozen it is ---
+    float flowSpeedMultiplier = 1.0f - riverFreezeAmount;
+    if (currentWeather == RAINY) {
+        riverFlowOffset -= 0.06f * flowSpeedMultiplier;
+    } else {
+        riverFlowOffset -= 0.02f * flowSpeedMultiplier;
+    }
+
+    if (currentWeather == RAINY) fox.pausedTicks++;
+}
+
+// --- Simulation Tasks ---
+// Each subsystem update declares the state it reads and writes. runSimTasks()
+// starts, in table order, every task that does not conflict with a task
+// already running or with an earlier task still waiting, so two tasks that
+// touch the same state always run in the order they are listed. The masks
+// are the only ordering there is: updateSceneState() writes RES_SCENE, so
+// every task that reads it waits for the scene step. A task that touches
+// state it does not declare races with the others.
+//
+// A task may also declare when its effect is visible; while that predicate is
+// false the task is not run at all. The predicate is checked when the task
+// could start, after the tasks writing what it reads. Elves and leaves hold
+// still while hidden and resume where they stopped. Birds are evaluated from
+// the clock, so their first step back catches up on every wrap-around they
+// missed.
+
+enum SimResource {
+    RES_SCENE       = 1 << 0,  // weather, time of day, campfires, snow cover, river
+    RES_LEAVES      = 1 << 1,
+    RES_ELVES       = 1 << 2,
+    RES_BIRDS       = 1 << 3,
+    RES_RAIN        = 1 << 4,  // raindrops, splashes, droplets
+    RES_PARTICLES   = 1 << 5,
+    RES_BUTTERFLIES = 1 << 6,
+    RES_FIREFLIES   = 1 << 7,
+    RES_PUDDLES     = 1 << 8,
+    RES_SNOW        = 1 << 9
+};
+
+struct SimTask {
+    const char* name;
+    void (*update)();
+    unsigned reads, writes;
+    bool (*visible)();   // nullptr = always simulated
+};
+
+// Visibility predicates. Birds and leaves match the checks in drawBirds() and
+// drawLeaves(). Elves are drawn at night too, but elvesVisible() matches the
+// early return in updateElves(): they only move in clear daylight.
+bool clearSky() { return currentWeather != RAINY && currentWeather != SNOWY; }
+bool birdsVisible() { return clearSky() && timeMomentAt(dayNightPhase) != NIGHT; }
+bool elvesVisible() { return clearSky() && timeMomentAt(dayNightPhase) != NIGHT; }
+bool leavesVisible() { return currentWeather != SNOWY; }
+
+SimTask simTasks[] = {
+    { "updateSceneState",      updateSceneState,                 0,                    RES_SCENE | RES_PUDDLES, nullptr },
+    { "updateLeaves",          updateLeaves,                     RES_SCENE,            RES_LEAVES,              leavesVisible },
+    { "updateElves",           updateElves,                      RES_SCENE,            RES_ELVES,               elvesVisible },
+    { "updateBirds",           updateBirds,                      RES_SCENE,            RES_BIRDS,               birdsVisible },
+    { "updateRainAndSplashes", updateRainAndSplashes,            RES_SCENE,            RES_RAIN,                nullptr },
+    { "updateParticles",       [] { updateParticles(SIM_DT); },  RES_SCENE,            RES_PARTICLES,           nullptr },
+    { "updateButterflies",     updateButterflies,                RES_SCENE,            RES_BUTTERFLIES,         nullptr },
+    { "updateFireflies",       updateFireflies,                  RES_SCENE,            RES_FIREFLIES,           nullptr },
+    { "updatePuddles",         [] { updatePuddles(SIM_DT); },    RES_SCENE | RES_RAIN, RES_PUDDLES,             nullptr },
+    { "updateSnow",            updateSnow,                       RES_SCENE,            RES_SNOW,                nullptr },
+};
+const int SIM_TASK_COUNT = sizeof(simTasks) / sizeof(simTasks[0]);
+
+void runSimTasks() {
+    bool started[SIM_TASK_COUNT] = {};
+    int remaining = SIM_TASK_COUNT;
+
+    while (remaining > 0) {
+        JobCounter wave;
+        unsigned busyReads = 0, busyWrites = 0;
+        for (int i = 0; i < SIM_TASK_COUNT; ++i) {
+            if (started[i]) continue;
+            const SimTask& task = simTasks[i];
+            bool conflicts = (task.writes & (busyReads | busyWrites)) || (task.reads & busyWrites);
+            if (!conflicts && task.visible && !task.visible()) {
+                started[i] = true;
+                --remaining;
+                continue;
+            }
+            busyReads |= task.reads;
+            busyWrites |= task.writes;
+            if (conflicts) continue;
+
+            started[i] = true;
+            --remaining;
+            submitJob(wave, [&task] {
+                ProfileZone zone(task.name);
+                task.update();
+            });
+        }
+        waitForJobs(wave);
+    }
+}
+
+// Advances the world by one fixed SIM_DT step.
+void updateScene() {
+    ProfileZone zone("updateScene");
+    storePreviousPositions();
+    simTick++;
+    runSimTasks();
+}
+
+// --- Simulation Clock ---
+// Jumps and speed changes for the simulation. setTimeOfDay() scrubs the day
+// phase without touching anything else. fastForward() advances every
+// time-dependent quantity by a span of steps in one go: the clock, day phase
+// and crystal/fire phases, snow cover, river freeze and flow, the fox and the
+// puddles are brought forward in closed form, and the clock-driven actors
+// follow from simTick. Rain, snow, leaves and particles are steady-state
+// effects and carry on from where they are; puddles are not seeded by the
+// skipped rain. simTimeScale scales wall time in frameLoop(). All of these
+// must run with no simulation steps in flight (see finishSimulation()).
+
+float simTimeScale = 1.0f;
+const float MIN_TIME_SCALE = 1.0f / 16.0f;
+const float MAX_TIME_SCALE = 256.0f;
+
+void setTimeOfDay(float phase) {
+    dayNightPhase = phase - floorf(phase);
+    storePreviousPositions();
+}
+
+void setTimeScale(float scale) {
+    simTimeScale = max(MIN_TIME_SCALE, min(MAX_TIME_SCALE, scale));
+}
+
+// Moves `value` toward `target` by `step` per tick for `ticks` ticks; returns
+// how many of those ticks it was still moving.
+long long rampToward(float& value, float target, float step, long long ticks) {
+    long long moving = min(ticks, ticksToCover(fabsf(target - value), step));
+    value = target > value ? min(target, value + step * moving) : max(target, value - step * moving);
+    return moving;
+}
+
+void fastForward(double seconds) {
+    long long ticks = llround(seconds / SIM_DT);
+    if (ticks <= 0) return;
+
+    simTick += ticks;
+    dayNightPhase = (float)fmod(dayNightPhase + (double)DAY_PHASE_PER_TICK * ticks, 1.0);
+    crystalGlow += CRYSTAL_GLOW_PER_TICK * ticks;
+    for (auto& fire : campfires) {
+        fire.flamePhase1 += 0.1f * ticks;
+        fire.flamePhase2 += 0.07f * ticks;
+    }
+
+    if (currentWeather == SNOWY) {
+        rampToward(snowCoverage, 1.0f, 0.0015f, ticks);
+    } else if (currentWeather == RAINY) {
+        long long melting = rampToward(snowCoverage, 0.0f, 0.002f, ticks);
+        for (long long i = 0; i < melting; ++i) {
+            if (randomInt(RNG_PUDDLES, 100) != 0) continue;
+            float x = -2.0f + randomFloat(RNG_PUDDLES) * 4.0f;
+            float y = -0.8f + randomFloat(RNG_PUDDLES) * 0.7f;
+            tryAddPuddle(x, y, 0.06f + randomFloat(RNG_PUDDLES) * (PUDDLE_MAX_RADIUS - 0.06f));
+        }
+    } else {
+        rampToward(snowCoverage, 0.0f, 0.003f, ticks);
+    }
+
+    // The river flows at (1 - freeze) of full speed; sum that over the ramp
+    // of the freeze amount and the steady span after it.
+    float freezeStep = 0.0025f;
+    float freezeBefore = riverFreezeAmount;
+    long long ramping = rampToward(riverFreezeAmount, currentWeather == SNOWY ? 1.0f : 0.0f, freezeStep, ticks);
+    float direction = currentWeather == SNOWY ? 1.0f : -1.0f;
+    double flowTicks = ramping * (1.0 - freezeBefore) - direction * freezeStep * ramping * (ramping + 1) / 2.0 +
+                       (ticks - ramping) * (1.0 - riverFreezeAmount);
+    riverFlowOffset -= (float)((currentWeather == RAINY ? 0.06 : 0.02) * flowTicks);
+
+    if (currentWeather == RAINY) fox.pausedTicks += ticks;
+    advancePuddles(ticks);
+    storePreviousPositions();
+}
+
+// Copies the simulation state the draw functions read into `view`.
+// Must only be called while no simulation steps are in flight.
+void publishSnapshot() {
+    view.simTick = simTick;
+    view.dayNightPhase = dayNightPhase;
+    view.crystalGlow = crystalGlow;
+    view.riverFlowOffset = riverFlowOffset;
+    view.snowCoverage = snowCoverage;
+    view.riverFreezeAmount = riverFreezeAmount;
+
+    view.campfires = campfires;
+    view.fox = fox;
+    memcpy(view.elves, elves, sizeof(elves));
+    memcpy(view.stars, stars, sizeof(stars));
+    memcpy(view.clouds, clouds, sizeof(clouds));
+    memcpy(view.birds, birds, sizeof(birds));
+    view.butterflies.copyFrom(butterflies);
+    view.fireflies.copyFrom(fireflies);
+    view.puddles.copyFrom(puddles);
+    view.splashes.copyFrom(splashes);
+    view.droplets.copyFrom(droplets);
+    view.leaves = leaves;
+
+    view.rainCount = currentWeather == RAINY ? rainCount : 0;
+    memcpy(view.rainX, raindrops.x, view.rainCount * sizeof(float));
+    memcpy(view.rainY, raindrops.y, view.rainCount * sizeof(float));
+
+    view.snowCount = currentWeather == SNOWY ? snowCount : 0;
+    memcpy(view.snowX, snowflakes.x, view.snowCount * sizeof(float));
+    memcpy(view.snowY, snowflakes.y, view.snowCount * sizeof(float));
+    memcpy(view.snowSize, snowflakes.size, view.snowCount * sizeof(float));
+
+    for (int type = 0; type < PARTICLE_TYPE_COUNT; ++type) {
+        const ParticleStream& s = particleStreams[type];
+        ParticleView& p = view.particles[type];
+        p.count = s.count;
+        memcpy(p.xy, s.xy, s.count * 2 * sizeof(float));
+        memcpy(p.size, s.size, s.count * sizeof(float));
+        memcpy(p.rgba, s.rgba, s.count * 4 * sizeof(float));
+    }
+}
+
+JobCounter simulationInFlight;
+
+// Blocks until the steps started by the last frameLoop() have finished.
+// Anything that changes simulation state from the GLUT thread (keyboard
+// input) calls this first.
+void finishSimulation() {
+    waitForJobs(simulationInFlight);
+}
+
+// GLUT idle callback. Collects the steps started last frame, publishes them
+// to `view`, then starts as many fixed steps as the elapsed time covers on
+// the job system and asks for a redraw, so this frame's draw overlaps the
+// next frame's simulation. After a long hitch at most MAX_SIM_STEPS_PER_FRAME
+// steps are run and the rest of the backlog is dropped, so a slow frame
+// cannot snowball into ever longer catch-up frames. Wall time is scaled by
+// simTimeScale; when it is sped up, the backlog is fast-forwarded instead.
+void frameLoop() {
+    static chrono::steady_clock::time_point lastFrameTime = chrono::steady_clock::now();
+    static int stepsInFlight = 0;
+
+    finishSimulation();
+    if (stepsInFlight > 0) publishSnapshot();
+
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    simAccumulator += chrono::duration<double>(now - lastFrameTime).count() * simTimeScale;
+    lastFrameTime = now;
+
+    int steps = 0;
+    while (simAccumulator >= SIM_DT && steps < MAX_SIM_STEPS_PER_FRAME) {
+        simAccumulator -= SIM_DT;
+        ++steps;
+    }
+    if (simAccumulator >= SIM_DT) {
+        double backlog = simAccumulator;
+        simAccumulator = fmod(simAccumulator, (double)SIM_DT);
+        if (simTimeScale > 1.0f) fastForward(backlog - simAccumulator);
+    }
+
+    stepsInFlight = steps;
+    if (steps > 0) {
+        submitJob(simulationInFlight, [steps] {
+            for (int i = 0; i < steps; ++i) updateScene();
+        });
+    }
+
+    renderAlpha = (float)(simAccumulator / SIM_DT);
+    glutPostRedisplay();
+}
+
+// Sets the flickering campfire light from the current fire phase.
+void updateCampfireLight() {
+    if (view.campfires.empty()) return;
+
+    if (currentWeather == RAINY || currentWeather == SNOWY) {
+        GLfloat lightOff[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+        glLightfv(GL_LIGHT1, GL_DIFFUSE, lightOff);
+        glLightfv(GL_LIGHT1, GL_SPECULAR, lightOff);
+    } else {
+        float lightStrength = 0.8f + 0.2f * sinf(view.campfires[0].flamePhase1);
+        if (getTimeMoment() == NOON || getTimeMoment() == MORNING) {
+            lightStrength *= 0.5f;
+        }
+
+        GLfloat lightPos[] = { view.campfires[0].x, view.campfires[0].y, -1.0f, 1.0f }; // Position light at the fire
+        GLfloat lightColor[] = { 1.0f * lightStrength, 0.6f * lightStrength, 0.2f * lightStrength, 1.0f }; // Warm, flickering color
+
+        glLightfv(GL_LIGHT1, GL_POSITION, lightPos);
+        glLightfv(GL_LIGHT1, GL_DIFFUSE, lightColor);
+        glLightfv(GL_LIGHT1, GL_SPECULAR, lightColor);
+
+        glLightf(GL_LIGHT1, GL_CONSTANT_ATTENUATION, 0.5f);
+        glLightf(GL_LIGHT1, GL_LINEAR_ATTENUATION, 1.0f);
+        glLightf(GL_LIGHT1, GL_QUADRATIC_ATTENUATION, 1.0f);
+    }
+}
+
+
+// --- Static Geometry Cache ---
+
+void drawGroundLayer() {
+    drawHills();
+    if (currentWeather == SNOWY) {
+        drawSnowOnHills();
+    }
+    drawGroundPatches();
+    drawFoxPath();
+    drawSceneProps(LAYER_GROUND);
+}
+
+void buildStaticLayer(StaticLayer layer) {
+    switch (layer) {
+        case LAYER_GROUND:           drawGroundLayer(); break;
+        case LAYER_MUSHROOMS:        drawSceneProps(layer); break;
+        case LAYER_FIELDS_AND_TREES: drawSceneProps(layer); break;
+        case LAYER_VILLAGE_PROPS:    drawSceneProps(layer); break;
+        case LAYER_GREAT_TREE:       drawGreatTreeBody(); break;
+        case LAYER_TREE_HOUSES:      drawGreatTreeHouses(); break;
+        case LAYER_HOUSES:           drawSceneProps(layer); break;
+        default: break;
+    }
+    flushRenderQueue(); // queued glows are compiled into the layer's list
+}
+
+// Recompiles every static layer if the weather, time of day, scene tint or
+// window scale has changed since the lists were last built. The tint only
+// changes during the short transitions between times of day; the scale
+// matters because glows compiled as points are sized in pixels. Called once
+// per frame, after updateSceneTint().
+void updateStaticGeometryCache() {
+    TimeMoment tm = getTimeMoment();
+    if (staticLayerLists != 0 && cachedWeather == currentWeather && cachedTimeMoment == tm &&
+        cachedPixelsPerUnit == pixelsPerUnit && memcmp(&cachedTint, &sceneTint, sizeof(SceneTint)) == 0) {
+        return;
+    }
+
+    if (staticLayerLists == 0) {
+        staticLayerLists = glGenLists(STATIC_LAYER_COUNT);
+    }
+
+    for (int i = 0; i < STATIC_LAYER_COUNT; ++i) {
+        glNewList(staticLayerLists + i, GL_COMPILE);
+        buildStaticLayer(static_cast<StaticLayer>(i));
+        glEndList();
+    }
+
+    cachedWeather = currentWeather;
+    cachedTimeMoment = tm;
+    cachedTint = sceneTint;
+    cachedPixelsPerUnit = pixelsPerUnit;
+}
+
+void drawStaticLayer(StaticLayer layer) {
+    glCallList(staticLayerLists + layer);
 }
 
 
-void updateStars() {
-    for (int i = 0; i < STAR_COUNT; ++i) {
-        stars[i].alpha = 0.5f + 0.5f * sinf(stars[i].initialPhase + crystalGlow * stars[i].twinkleSpeed);
-    }
+// --- Asset Pack ---
+// Startup assets ship as one file, silvine.pak, which is memory-mapped and
+// never copied: the mixer reads entries straight from the mapping. Layout:
+//   AssetPackHeader               magic "SVPK", version, entry count
+//   AssetPackEntry[entryCount]    name, offset and size of each entry
+//   entry data                    each entry starts on an ASSET_PACK_ALIGN boundary
+// `--pack-assets DIR OUT` builds a pack from every file in DIR; adding `--pcm`
+// stores audio files already decoded to the mixer's sample format, so startup
+// skips the mp3 decoder too. `--assets PATH` picks the pack to load.
+
+const char ASSET_PACK_MAGIC[4] = { 'S', 'V', 'P', 'K' };
+const uint32_t ASSET_PACK_VERSION = 1;
+const uint64_t ASSET_PACK_ALIGN = 4096;
+const uint32_t ASSET_ENTRY_PCM = 1;   // raw samples in the entry's pcm* format
+
+struct AssetPackHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t reserved;
+};
+
+struct AssetPackEntry {
+    char name[48];          // file name, NUL-terminated
+    uint64_t offset;        // from the start of the pack
+    uint64_t size;
+    uint32_t flags;
+    uint32_t pcmFrequency;  // ASSET_ENTRY_PCM only
+    uint16_t pcmFormat;
+    uint16_t pcmChannels;
+    uint32_t reserved;
+};
+
+// A read-only view of a whole file.
+struct MappedFile {
+    const unsigned char* base = nullptr;
+    size_t size = 0;
+#if defined(_WIN32)
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#endif
+};
+
+bool fileExists(const char* path) {
+#if defined(_WIN32)
+    return GetFileAttributesA(path) != INVALID_FILE_ATTRIBUTES;
+#else
+    struct stat info;
+    return stat(path, &info) == 0;
+#endif
 }
 
-void updateClouds() {
-   for (int i = 0; i < CLOUD_COUNT; ++i) {
-       clouds[i].x += clouds[i].speed;
-        if (clouds[i].x > 4.0f) {
-           clouds[i].x = -4.0f;
-       }
+bool mapFile(const char* path, MappedFile& mapped) {
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        printf("Cannot open %s\n", path);
+        return false;
     }
- }
-
-void updateBirds() {
-    for (int i = 0; i < MAX_BIRDS; i++) {
-        birds[i].x += birds[i].speed;
-        birds[i].phase += 0.2f + birds[i].speed * 10.0f;
-        if (birds[i].x > 3.0f) {
-            birds[i].x = -3.0f;
-            birds[i].y = 0.8f + (static_cast<float>(rand()) / RAND_MAX) * 0.6f;
-            birds[i].speed = 0.006f + (static_cast<float>(rand()) / RAND_MAX) * 0.004f;
-        }
+    LARGE_INTEGER fileSize;
+    HANDLE mapping = GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0
+        ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+    const void* base = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (!base) {
+        printf("Cannot map %s\n", path);
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
     }
+    mapped.file = file;
+    mapped.mapping = mapping;
+    mapped.size = (size_t)fileSize.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Cannot open %s\n", path);
+        return false;
+    }
+    struct stat info;
+    void* base = fstat(fd, &info) == 0 && info.st_size > 0
+        ? mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd); // the mapping keeps the file alive
+    if (base == MAP_FAILED) {
+        printf("Cannot map %s\n", path);
+        return false;
+    }
+    mapped.size = (size_t)info.st_size;
+#endif
+    mapped.base = (const unsigned char*)base;
+    return true;
 }
 
-void updateLeaves() {
-    if (currentWeather == SNOWY) return;
-
-    float y_offset = -0.1f;
-    for (int i = 0; i < LEAF_COUNT; ++i) {
-        leaves[i].y -= leaves[i].speed;
-        leaves[i].x += sinf(leaves[i].sway) * 0.001f;
-        leaves[i].sway += leaves[i].swaySpeed;
-        leaves[i].rotation += leaves[i].rotationSpeed;
-        if (leaves[i].y < -1.5f) {
-            leaves[i].x = -0.6f + (rand() / (float)RAND_MAX) * 1.2f;
-            leaves[i].y = (0.0f + y_offset) + (rand() / (float)RAND_MAX) * 0.8f;
-        }
-    }
+void unmapFile(MappedFile& mapped) {
+    if (!mapped.base) return;
+#if defined(_WIN32)
+    UnmapViewOfFile(mapped.base);
+    CloseHandle(mapped.mapping);
+    CloseHandle(mapped.file);
+#else
+    munmap((void*)mapped.base, mapped.size);
+#endif
+    mapped = MappedFile();
 }
 
-void updateSnow() {
-    if (currentWeather != SNOWY) return;
+struct AssetPack {
+    MappedFile file;
+    const AssetPackEntry* entries = nullptr;
+    uint32_t entryCount = 0;
+};
 
-    for (int i = 0; i < SNOW_COUNT; ++i) {
-        snowflakes[i].y -= snowflakes[i].speed;
-        // Add a gentle horizontal sway
-        snowflakes[i].x += sinf(snowflakes[i].swayPhase + snowflakes[i].y * 2.0f) * 0.001f;
+const char* assetPackPath = "silvine.pak";
+bool assetPackRequested = false; // --assets given; a missing pack is then an error
+AssetPack assetPack;
+const char* packAssetsDir = nullptr;
+const char* packAssetsOut = nullptr;
+bool packAssetsPcm = false;
 
-        // Reset snowflake to the top when it falls off-screen
-        if (snowflakes[i].y < -1.5f) {
-            snowflakes[i].y = 1.5f;
-            snowflakes[i].x = -3.0f + (rand() / (float)RAND_MAX) * 6.0f;
+void closeAssetPack() {
+    unmapFile(assetPack.file);
+    assetPack = AssetPack();
+}
+
+// Maps the pack read-only and checks that the header and every entry lie
+// inside the file. On failure nothing stays mapped.
+bool openAssetPack(const char* path) {
+    closeAssetPack();
+    if (!mapFile(path, assetPack.file)) return false;
+    const unsigned char* base = assetPack.file.base;
+    size_t size = assetPack.file.size;
+
+    const AssetPackHeader* header = (const AssetPackHeader*)base;
+    bool valid = size >= sizeof(AssetPackHeader) &&
+                 memcmp(header->magic, ASSET_PACK_MAGIC, 4) == 0 &&
+                 header->version == ASSET_PACK_VERSION &&
+                 header->entryCount <= (size - sizeof(AssetPackHeader)) / sizeof(AssetPackEntry);
+    if (valid) {
+        assetPack.entries = (const AssetPackEntry*)(base + sizeof(AssetPackHeader));
+        assetPack.entryCount = header->entryCount;
+        for (uint32_t i = 0; i < assetPack.entryCount && valid; ++i) {
+            const AssetPackEntry& entry = assetPack.entries[i];
+            valid = entry.offset <= size && entry.size <= size - entry.offset &&
+                    memchr(entry.name, 0, sizeof(entry.name)) != NULL;
         }
     }
+    if (!valid) {
+        printf("Asset pack: %s is not a version %u pack\n", path, ASSET_PACK_VERSION);
+        closeAssetPack();
+        return false;
+    }
+    printf("Asset pack: %s, %u entries, %zu KB mapped\n", path, assetPack.entryCount, size / 1024);
+    return true;
 }
 
-void drawParticles() {
-    glPushAttrib(GL_ENABLE_BIT);
-    glDisable(GL_LIGHTING);
-    glEnable(GL_BLEND);
-    glPointSize(3.0f);
+const AssetPackEntry* findAsset(const char* name) {
+    for (uint32_t i = 0; i < assetPack.entryCount; ++i) {
+        if (strcmp(assetPack.entries[i].name, name) == 0) return &assetPack.entries[i];
+    }
+    return NULL;
+}
 
-    // Draw Sparks and Embers (Points)
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE); // Additive blending for glows
-    glBegin(GL_POINTS);
-    for (const auto& p : particles) {
-        float alpha = p.life / p.maxLife;
-        if (p.type == SPARK || p.type == EMBER) {
-            glColor4f(p.r, p.g, p.b, alpha);
-            glVertex2f(p.x, p.y);
+// Turns a pack entry into a mixer chunk. PCM entries in the mixer's own format
+// become chunks that point into the mapping (Mix_QuickLoad_RAW does not copy
+// or free); compressed entries are decoded from the mapping via an SDL_RWops.
+Mix_Chunk* loadAudioAsset(const char* name) {
+    const AssetPackEntry* entry = findAsset(name);
+    if (!entry) {
+        printf("Load Error: %s - not in %s\n", name, assetPackPath);
+        return NULL;
+    }
+    const unsigned char* data = assetPack.file.base + entry->offset;
+    if (entry->flags & ASSET_ENTRY_PCM) {
+        int frequency, channels;
+        Uint16 format;
+        if (!Mix_QuerySpec(&frequency, &format, &channels) || (int)entry->pcmFrequency != frequency ||
+            entry->pcmFormat != format || entry->pcmChannels != channels) {
+            printf("Load Error: %s - packed PCM does not match the mixer format\n", name);
+            return NULL;
         }
+        // The mixer only reads chunk samples, so the read-only mapping is safe.
+        return Mix_QuickLoad_RAW((Uint8*)data, (Uint32)entry->size);
     }
-    glEnd();
-
-    // Draw Smoke (Circles)
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); // Standard transparency for smoke
-    for (const auto& p : particles) {
-        if (p.type == SMOKE) {
-            float alpha = p.life / p.maxLife;
-            // Smoke fades out as it gets higher
-            alpha *= (1.0f - (p.y - (-0.6f)) / 0.5f); // Fade based on height above ground
-            if (alpha < 0) alpha = 0;
+    Mix_Chunk* chunk = Mix_LoadWAV_RW(SDL_RWFromConstMem(data, (int)entry->size), 1);
+    if (!chunk) printf("Load Error: %s - %s\n", name, Mix_GetError());
+    return chunk;
+}
 
-            glColor4f(p.r, p.g, p.b, alpha * p.a);
-            drawCircle(p.x, p.y, p.size);
+// Regular files directly inside dir, sorted so a pack's layout is reproducible.
+vector<string> listAssetFiles(const char* dir) {
+    vector<string> names;
+#if defined(_WIN32)
+    string pattern = string(dir) + "\\*";
+    WIN32_FIND_DATAA found;
+    HANDLE find = FindFirstFileA(pattern.c_str(), &found);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) names.push_back(found.cFileName);
+        } while (FindNextFileA(find, &found));
+        FindClose(find);
+    }
+#else
+    if (DIR* d = opendir(dir)) {
+        while (dirent* e = readdir(d)) {
+            struct stat info;
+            string path = string(dir) + "/" + e->d_name;
+            if (stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode)) names.push_back(e->d_name);
         }
+        closedir(d);
     }
-
-    glPopAttrib();
+#endif
+    sort(names.begin(), names.end());
+    return names;
 }
 
-void updateParticles(float dt) {
-    // --- Emit New Particles ---
-
-     if (currentWeather != RAINY && currentWeather != SNOWY) {
-        if (!campfires.empty() && particles.size() < MAX_PARTICLES) {
-            const auto& fire = campfires[0];
+bool isAudioAsset(const string& name) {
+    size_t dot = name.rfind('.');
+    if (dot == string::npos) return false;
+    string ext = name.substr(dot);
+    for (char& c : ext) c = (char)tolower((unsigned char)c);
+    return ext == ".wav" || ext == ".mp3" || ext == ".ogg" || ext == ".flac";
+}
 
-            // Sparks
-            if (rand() % 4 == 0) {
-                particles.push_back(Particle{SPARK, fire.x, fire.y + 0.05f, (rand()%100-50)/8000.f, 0.002f, 0.2f, 0.2f, 0.f, 1.0f, 0.8f, 0.2f, 1.f});
-            }
-            // Embers
-            if (rand() % 15 == 0) {
-                particles.push_back(Particle{EMBER, fire.x, fire.y, (rand()%100-50)/3000.f, 0.002f, 0.4f, 0.4f, 0.f, 1.0f, 0.4f, 0.0f, 1.f});
-            }
-            // Smoke
-            if (rand() % 5 == 0) {
-                float initialSmokeRadius = 0.01f;
-                float initialSmokeVY = 0.003f + (rand() / (float)RAND_MAX) * 0.002f;
-                particles.push_back(Particle{SMOKE, fire.x + (-0.01f + (rand() / (float)RAND_MAX) * 0.02f), fire.y + 0.08f,
-                                             (-0.0005f + (rand() / (float)RAND_MAX) * 0.001f), initialSmokeVY,
-                                             2.0f + (rand() / (float)RAND_MAX) * 1.0f, 3.0f, initialSmokeRadius,
-                                             0.8f, 0.8f, 0.8f, 0.4f});
-            }
+// `--pack-assets DIR OUT [--pcm]`. PCM decoding opens the mixer on SDL's dummy
+// driver with the same spec as initAudio(), so it runs on build machines
+// without a sound device.
+int runPackAssets(const char* dir, const char* outPath, bool pcm) {
+    vector<string> names = listAssetFiles(dir);
+    if (names.empty()) {
+        printf("Asset pack: no files in %s\n", dir);
+        return 1;
+    }
+    int frequency = 0, channels = 0;
+    Uint16 format = 0;
+    if (pcm) {
+        SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+        if (SDL_Init(SDL_INIT_AUDIO) < 0 || Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 2048) < 0) {
+            printf("Asset pack: cannot open the mixer to decode PCM: %s\n", Mix_GetError());
+            return 1;
         }
+        Mix_QuerySpec(&frequency, &format, &channels);
     }
 
-
-    for (size_t i = 0; i < particles.size(); ) {
-        particles[i].life -= dt;
-        if (particles[i].life <= 0) {
-            particles.erase(particles.begin() + i);
+    vector<AssetPackEntry> entries(names.size());
+    vector<vector<unsigned char>> blobs(names.size());
+    uint64_t offset = sizeof(AssetPackHeader) + names.size() * sizeof(AssetPackEntry);
+    int failures = 0;
+    for (size_t i = 0; i < names.size(); ++i) {
+        AssetPackEntry& entry = entries[i];
+        memset(&entry, 0, sizeof(entry));
+        if (names[i].size() >= sizeof(entry.name)) {
+            printf("Asset pack: cannot pack %s, name longer than %zu bytes\n", names[i].c_str(), sizeof(entry.name) - 1);
+            ++failures;
             continue;
         }
-
-        if (particles[i].type == SPARK) {
-            particles[i].vy -= 0.0003f;
-        } else if (particles[i].type == EMBER) {
-            particles[i].vy -= 0.00005f;
-            particles[i].vx *= 0.98f;
-        } else if (particles[i].type == SMOKE) {
-            particles[i].size += dt * 0.05f;
-            particles[i].vy *= 1.005f;
-            particles[i].vx *= 0.99f;
+        strcpy(entry.name, names[i].c_str());
+        string path = string(dir) + "/" + names[i];
+
+        Mix_Chunk* chunk = pcm && isAudioAsset(names[i]) ? Mix_LoadWAV(path.c_str()) : NULL;
+        if (chunk) {
+            blobs[i].assign(chunk->abuf, chunk->abuf + chunk->alen);
+            Mix_FreeChunk(chunk);
+            entry.flags = ASSET_ENTRY_PCM;
+            entry.pcmFrequency = (uint32_t)frequency;
+            entry.pcmFormat = format;
+            entry.pcmChannels = (uint16_t)channels;
+        } else if (FILE* file = fopen(path.c_str(), "rb")) {
+            fseek(file, 0, SEEK_END);
+            long length = ftell(file);
+            fseek(file, 0, SEEK_SET);
+            blobs[i].resize(length > 0 ? (size_t)length : 0);
+            if (fread(blobs[i].data(), 1, blobs[i].size(), file) != blobs[i].size()) ++failures;
+            fclose(file);
+        } else {
+            printf("Asset pack: cannot read %s\n", path.c_str());
+            ++failures;
+            continue;
         }
+        offset = (offset + ASSET_PACK_ALIGN - 1) / ASSET_PACK_ALIGN * ASSET_PACK_ALIGN;
+        entry.offset = offset;
+        entry.size = blobs[i].size();
+        offset += entry.size;
+        printf("  %-32s %10llu bytes%s\n", entry.name, (unsigned long long)entry.size,
+               (entry.flags & ASSET_ENTRY_PCM) ? " (PCM)" : "");
+    }
+    if (pcm) {
+        Mix_CloseAudio();
+        SDL_Quit();
+    }
+    if (failures > 0) {
+        printf("Asset pack: %d of %zu files failed, %s not written\n", failures, names.size(), outPath);
+        return 1;
+    }
 
-        particles[i].x += particles[i].vx;
-        particles[i].y += particles[i].vy;
-        i++;
+    FILE* out = fopen(outPath, "wb");
+    if (!out) {
+        printf("Asset pack: cannot write %s\n", outPath);
+        return 1;
+    }
+    AssetPackHeader header = {};
+    memcpy(header.magic, ASSET_PACK_MAGIC, 4);
+    header.version = ASSET_PACK_VERSION;
+    header.entryCount = (uint32_t)entries.size();
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(entries.data(), sizeof(AssetPackEntry), entries.size(), out);
+    for (size_t i = 0; i < entries.size(); ++i) {
+        static const unsigned char zeros[ASSET_PACK_ALIGN] = {};
+        fwrite(zeros, 1, (size_t)(entries[i].offset - (uint64_t)ftell(out)), out);
+        fwrite(blobs[i].data(), 1, blobs[i].size(), out);
+    }
+    bool written = ferror(out) == 0;
+    fclose(out);
+    if (!written) {
+        printf("Asset pack: write to %s failed\n", outPath);
+        return 1;
     }
+    printf("Asset pack: wrote %zu entries to %s (%llu KB)\n", entries.size(), outPath,
+           (unsigned long long)(offset / 1024));
+    return 0;
 }
 
-void updateScene(int) {
-    dayNightPhase += 0.0002f;
-    if (dayNightPhase > 1.0f) dayNightPhase = 0.0f;
-
-    crystalGlow += 0.05f;
-
-
-    if (!campfires.empty()) {
-        campfires[0].flamePhase1 += 0.1f;
-        campfires[0].flamePhase2 += 0.07f;
-
-
-        // ---  Update Snow Coverage based on Weather ---
-    if (currentWeather == SNOWY) {
-        if (snowCoverage < 1.0f) {
-            snowCoverage += 0.0015f; // Snow slowly accumulates
-        }
-    } else if (currentWeather == RAINY) {
-        if (snowCoverage > 0.0f) {
-            snowCoverage -= 0.002f; // Rain melts snow faster
-            // Chance to turn melting snow into a puddle
-            if (rand() % 100 == 0) {
-                 puddles.push_back({-2.0f + (rand() / (float)RAND_MAX) * 4.0f, -0.8f + (rand() / (float)RAND_MAX) * 0.7f, 0.0f, 0.1f + (rand() / (float)RAND_MAX) * 0.1f, PUDDLE_GROWING, 0.0f});
-            }
-        }
-    } else { // Sunny
-        if (snowCoverage > 0.0f) {
-            snowCoverage -= 0.003f; // Sun melts snow slowly
-        }
-    }
-    // Clamp the value between 0 and 1
-    if (snowCoverage < 0.0f) snowCoverage = 0.0f;
-    if (snowCoverage > 1.0f) snowCoverage = 1.0f;
+// --- Scene Layout ---
+// village.scene layout (little-endian):
+//   SceneLayoutHeader     magic "SVSC", version, prop count
+//   SceneProp[propCount]  sorted by type
+// `--export-scene PATH` writes the built-in layout in this format, as a
+// starting point for editing or generating denser villages.
+
+const char SCENE_LAYOUT_MAGIC[4] = { 'S', 'V', 'S', 'C' };
+const uint32_t SCENE_LAYOUT_VERSION = 1;
+
+struct SceneLayoutHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t propCount;
+    uint32_t reserved;
+};
 
+const char* sceneLayoutPath = nullptr;
+const char* exportScenePath = nullptr;
+MappedFile sceneLayoutFile;
 
-       if (currentWeather == RAINY || currentWeather == SNOWY) {
-            GLfloat lightOff[] = { 0.0f, 0.0f, 0.0f, 1.0f };
-            glLightfv(GL_LIGHT1, GL_DIFFUSE, lightOff);
-            glLightfv(GL_LIGHT1, GL_SPECULAR, lightOff);
-        } else {
-            float lightStrength = 0.8f + 0.2f * sinf(campfires[0].flamePhase1);
-            if (getTimeMoment() == NOON || getTimeMoment() == MORNING) {
-                lightStrength *= 0.5f;
-            }
+SceneProp makeProp(PropType type, float x, float y, float scale) {
+    return { (uint16_t)type, 0, x, y, scale, scale, { 1.0f, 1.0f, 1.0f } };
+}
 
-        GLfloat lightPos[] = { campfires[0].x, campfires[0].y, -1.0f, 1.0f }; // Position light at the fire
-        GLfloat lightColor[] = { 1.0f * lightStrength, 0.6f * lightStrength, 0.2f * lightStrength, 1.0f }; // Warm, flickering color
+SceneProp makeField(float x, float y, float width, float height) {
+    return { PROP_VEGETABLE_FIELD, 0, x, y, width, height, { 1.0f, 1.0f, 1.0f } };
+}
 
-        glLightfv(GL_LIGHT1, GL_POSITION, lightPos);
-        glLightfv(GL_LIGHT1, GL_DIFFUSE, lightColor);
-        glLightfv(GL_LIGHT1, GL_SPECULAR, lightColor);
+SceneProp makeFence(float x, float y, int sections) {
+    return { PROP_FENCE, (uint16_t)sections, x, y, 1.0f, 1.0f, { 1.0f, 1.0f, 1.0f } };
+}
 
-        glLightf(GL_LIGHT1, GL_CONSTANT_ATTENUATION, 0.5f);
-        glLightf(GL_LIGHT1, GL_LINEAR_ATTENUATION, 1.0f);
-        glLightf(GL_LIGHT1, GL_QUADRATIC_ATTENUATION, 1.0f);
-      }
+SceneProp makeFlower(float x, float y, float r, float g, float b, float scale = 1.0f) {
+    return { PROP_FLOWER, 0, x, y, scale, scale, { r, g, b } };
+}
 
+const SceneProp defaultSceneProps[] = {
+    makeProp(PROP_BUSH, -1.8f, -0.7f, 0.8f),
+    makeProp(PROP_BUSH, -0.79f, -0.57f, 0.7f),
+    makeProp(PROP_BUSH, 0.5f, -0.6f, 1.0f),
+    makeProp(PROP_BUSH, 2.4f, -0.5f, 0.8f),
+    makeProp(PROP_BUSH, 2.35f, -0.72f, 0.7f),
+    makeProp(PROP_BUSH, -2.4f, -0.5f, 0.9f),
+
+    makeProp(PROP_MUSHROOM, -0.6f, -0.7f, 1.0f),
+    makeProp(PROP_MUSHROOM, 0.78f, -0.68f, 0.8f),
+    makeProp(PROP_MUSHROOM, 0.84f, -0.69f, 0.7f),
+    makeProp(PROP_MUSHROOM, -2.41f, -0.3f, 0.7f),
+    makeProp(PROP_MUSHROOM, -2.43f, -0.22f, 0.7f),
+    makeProp(PROP_MUSHROOM, 2.3f, -0.22f, 0.7f),
+    makeProp(PROP_MUSHROOM, 2.4f, -0.22f, 0.7f),
+    makeProp(PROP_MUSHROOM, 2.35f, -0.18f, 0.7f),
+    makeProp(PROP_MUSHROOM, 0.45f, -0.45f, 0.7f),
+    makeProp(PROP_MUSHROOM, 0.37f, -0.42f, 0.7f),
+    makeProp(PROP_MUSHROOM, 0.43f, -0.39f, 0.7f),
+    makeProp(PROP_MUSHROOM, -0.68f, -0.7f, 0.9f),
+    makeProp(PROP_MUSHROOM, -0.7f, -0.45f, 0.75f),
+    makeProp(PROP_MUSHROOM, -0.77f, -0.45f, 0.75f),
+    makeProp(PROP_MUSHROOM, 1.5f, -0.45f, 0.7f),
+    makeProp(PROP_MUSHROOM, 1.56f, -0.42f, 0.7f),
+    makeProp(PROP_MUSHROOM, 1.6f, -0.47f, 0.7f),
+
+    makeField(-1.8f, -0.31f, 0.9f, 0.2f),
+    makeField(-0.8f, -0.31f, 0.9f, 0.2f),
+
+    makeProp(PROP_FIELD_TREE, -2.0f, -0.14f, 0.53f),
+    makeProp(PROP_FIELD_TREE, -2.3f, -0.14f, 0.6f),
+    makeProp(PROP_FIELD_TREE, -1.7f, -0.14f, 0.55f),
+    makeProp(PROP_FIELD_TREE, -1.4f, -0.14f, 0.52f),
+    makeProp(PROP_FIELD_TREE, -1.1f, -0.14f, 0.55f),
+    makeProp(PROP_FIELD_TREE, -0.78f, -0.14f, 0.6f),
+    makeProp(PROP_FIELD_TREE, 1.7f, -0.13f, 0.56f),
+    makeProp(PROP_FIELD_TREE, 0.8f, -0.12f, 0.55f),
+    makeProp(PROP_FIELD_TREE, 1.1f, -0.12f, 0.56f),
+    makeProp(PROP_FIELD_TREE, 1.4f, -0.12f, 0.57f),
+    makeProp(PROP_FIELD_TREE, 2.0f, -0.13f, 0.56f),
+    makeProp(PROP_FIELD_TREE, 2.3f, -0.13f, 0.55f),
+    makeProp(PROP_FIELD_TREE, 2.6f, -0.13f, 0.56f),
+
+    makeProp(PROP_ARCHERY_GROUND, 1.0f, -0.13f, 1.0f),
+
+    makeProp(PROP_WISHING_WELL, 1.8f, -0.2f, 1.0f),
+
+    makeProp(PROP_FRONT_TREE, -2.2f, -0.5f, 1.5f),
+    makeProp(PROP_FRONT_TREE, 1.25f, -0.5f, 1.7f),
+    makeProp(PROP_FRONT_TREE, 2.2f, -0.48f, 1.5f),
+
+    makeProp(PROP_LANTERN, 1.75f, -0.55f, 1.0f),
+    makeProp(PROP_LANTERN, 0.7f, -0.55f, 1.0f),
+    makeProp(PROP_LANTERN, -2.3f, -0.55f, 1.0f),
+    makeProp(PROP_LANTERN, -1.3f, -0.55f, 1.0f),
+
+    makeFence(1.2f, -0.7f, 5),
+
+    makeProp(PROP_HOUSE, -2.0f, -0.6f, 1.0f),
+    makeProp(PROP_HOUSE, -1.0f, -0.6f, 1.2f),
+    makeProp(PROP_HOUSE, 1.0f, -0.6f, 1.2f),
+    makeProp(PROP_HOUSE, 2.0f, -0.6f, 1.0f),
+
+    makeFlower(-0.5f, -0.8f, 1.0f, 0.4f, 0.4f),
+    makeFlower(-0.45f, -0.83f, 1.0f, 0.4f, 0.4f, 0.8f),
+    makeFlower(0.8f, -0.6f, 0.9f, 0.9f, 1.0f),
+    makeFlower(-2.32f, -0.2f, 0.9f, 0.9f, 1.0f),
+    makeFlower(2.2f, -0.7f, 0.6f, 0.6f, 1.0f),
+    makeFlower(-2.31f, -0.28f, 0.6f, 0.6f, 1.0f),
+    makeFlower(2.25f, -0.72f, 0.6f, 0.6f, 1.0f, 0.9f),
+    makeFlower(-2.31f, -0.78f, 0.6f, 0.6f, 1.0f),
+    makeFlower(-2.35f, -0.75f, 1.0f, 0.4f, 0.4f),
+    makeFlower(-2.4f, -0.78f, 0.9f, 0.9f, 1.0f),
+    makeFlower(0.7f, -0.45f, 1.0f, 0.4f, 0.4f, 0.8f),
+    makeFlower(0.76f, -0.45f, 1.0f, 0.9f, 0.9f, 1.0f),
+};
+const int DEFAULT_SCENE_PROP_COUNT = sizeof(defaultSceneProps) / sizeof(defaultSceneProps[0]);
+
+// Checks a mapped layout and returns its records, or NULL if it is not a
+// valid version 1 layout with known types in sorted order.
+const SceneProp* parseSceneLayout(const unsigned char* data, size_t size, int& count) {
+    const SceneLayoutHeader* header = (const SceneLayoutHeader*)data;
+    if (size < sizeof(SceneLayoutHeader) || memcmp(header->magic, SCENE_LAYOUT_MAGIC, 4) != 0 ||
+        header->version != SCENE_LAYOUT_VERSION ||
+        header->propCount > (size - sizeof(SceneLayoutHeader)) / sizeof(SceneProp)) {
+        return NULL;
     }
-
-   // ---  Update River Freeze/Melt ---
-    if (currentWeather == SNOWY) {
-        if (riverFreezeAmount < 1.0f) riverFreezeAmount += 0.0025f;
-    } else {
-        if (riverFreezeAmount > 0.0f) riverFreezeAmount -= 0.0025f;
+    const SceneProp* props = (const SceneProp*)(data + sizeof(SceneLayoutHeader));
+    for (uint32_t i = 0; i < header->propCount; ++i) {
+        if (props[i].type >= PROP_TYPE_COUNT || (i > 0 && props[i].type < props[i - 1].type)) return NULL;
     }
-    if (riverFreezeAmount > 1.0f) riverFreezeAmount = 1.0f;
-    if (riverFreezeAmount < 0.0f) riverFreezeAmount = 0.0f;
+    count = (int)header->propCount;
+    return props;
+}
 
-    // --- River Flow Speed now depends on how frozen it is ---
-    float flowSpeedMultiplier = 1.0f - riverFreezeAmount;
-    if (currentWeather == RAINY) {
-        riverFlowOffset -= 0.06f * flowSpeedMultiplier;
-    } else {
-        riverFlowOffset -= 0.02f * flowSpeedMultiplier;
+// Picks the layout source and finds where each type's group starts.
+void loadSceneLayout() {
+    const SceneProp* props = NULL;
+    int count = 0;
+    const char* source = "built-in";
+    if (sceneLayoutPath && mapFile(sceneLayoutPath, sceneLayoutFile)) {
+        props = parseSceneLayout(sceneLayoutFile.base, sceneLayoutFile.size, count);
+        source = sceneLayoutPath;
+        if (!props) unmapFile(sceneLayoutFile);
+    } else if (const AssetPackEntry* entry = findAsset("village.scene")) {
+        props = parseSceneLayout(assetPack.file.base + entry->offset, (size_t)entry->size, count);
+        source = "village.scene";
     }
-
-    if (currentWeather != RAINY) {
-        fox.progress += fox.speed * 0.016f;
-        if (fox.progress > 1.0f) {
-            fox.progress = 0.0f;
-        }
-        fox.tailSway += 0.08f;
+    if (!props) {
+        if (strcmp(source, "built-in") != 0) printf("Scene layout: %s is not a version %u layout\n", source, SCENE_LAYOUT_VERSION);
+        props = defaultSceneProps;
+        count = DEFAULT_SCENE_PROP_COUNT;
+        source = "built-in";
     }
+    sceneProps = props;
+    scenePropCount = count;
 
-    updateLeaves();
-     if (currentWeather == SUNNY) {
-        updateElves();
+    int type = 0;
+    for (int i = 0; i <= count; ++i) {
+        int groupType = i < count ? (int)props[i].type : (int)PROP_TYPE_COUNT;
+        while (type <= groupType) propGroupStart[type++] = i;
     }
-    updateStars();
-    updateClouds();
-    updateBirds();
-    updateRainAndSplashes();
-    updateParticles(0.016f);
-    updateButterflies();
-    updateFireflies();
-    updatePuddles(0.016f);
-    updateSnow();
-
-    glutPostRedisplay();
-    glutTimerFunc(16, updateScene, 0);
+    printf("Scene layout: %s, %d props\n", source, count);
 }
 
+int runExportScene(const char* path) {
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        printf("Scene layout: cannot write %s\n", path);
+        return 1;
+    }
+    SceneLayoutHeader header = {};
+    memcpy(header.magic, SCENE_LAYOUT_MAGIC, 4);
+    header.version = SCENE_LAYOUT_VERSION;
+    header.propCount = DEFAULT_SCENE_PROP_COUNT;
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(defaultSceneProps, sizeof(SceneProp), DEFAULT_SCENE_PROP_COUNT, out);
+    bool written = ferror(out) == 0;
+    fclose(out);
+    if (!written) {
+        printf("Scene layout: write to %s failed\n", path);
+        return 1;
+    }
+    printf("Scene layout: wrote %d props to %s\n", DEFAULT_SCENE_PROP_COUNT, path);
+    return 0;
+}
 
 // --- Main GLUT and Program Functions ---
 
-void display() {
+const int WINDOW_WIDTH = 1920;
+const int WINDOW_HEIGHT = 1080;
+int windowWidth = WINDOW_WIDTH, windowHeight = WINDOW_HEIGHT;
+
+// Draws the published snapshot into the current framebuffer.
+void renderScene() {
+    resetFrameArena();
+    updateSceneTint();
+    { ProfileZone zone("updateSpriteAtlas"); updateSpriteAtlas(); }
     glClear(GL_COLOR_BUFFER_BIT);
 
+    { ProfileZone zone("updateStaticGeometryCache"); updateStaticGeometryCache(); }
+    { ProfileZone zone("updateCampfireLight"); updateCampfireLight(); }
+
 
     // Draw skybox elements first
-    drawSky();
+    { ProfileZone zone("drawSky"); drawSky(); }
 
 
     if (currentWeather != RAINY && currentWeather != SNOWY) {
-        drawStars();
-        drawSunAndMoon();
+        { ProfileZone zone("drawStars"); drawStars(); }
+        { ProfileZone zone("drawSunAndMoon"); drawSunAndMoon(); }
     }
     if (currentWeather != SNOWY) {
-        drawBirds();
+        { ProfileZone zone("drawBirds"); drawBirds(); }
     }
 
-    drawClouds();
+    { ProfileZone zone("drawClouds"); drawClouds(); }
 
     // Draw all ground-level and foreground elements
-    drawHills();
-     if (currentWeather == SNOWY) {
-         drawSnowOnHills();
-    }
-    drawGroundPatches();
-    drawFoxPath();
-    drawFlowersAndBushes();
-    drawVillageDetails();
-    drawCampfire();
+    { ProfileZone zone("drawStaticLayer(ground)"); drawStaticLayer(LAYER_GROUND); }
+    { ProfileZone zone("drawFlowers"); drawFlowers(); }
+    { ProfileZone zone("drawVillageDetails"); drawVillageDetails(); }
+    { ProfileZone zone("drawCampfire"); drawCampfire(); }
 
-    drawFairyFox();
+    { ProfileZone zone("drawFairyFox"); drawFairyFox(); }
 
-    drawCrystal(-0.5f, -0.5f);
-    drawGreatTree();
-    drawLeaves();
+    { ProfileZone zone("drawCrystal"); drawCrystal(-0.5f, -0.5f); }
+    { ProfileZone zone("drawGreatTree"); drawGreatTree(); }
+    { ProfileZone zone("drawLeaves"); drawLeaves(); }
 
 
-    drawHouse(-2.0f, -0.6f, 1.0f);
-    drawHouse(-1.0f, -0.6f, 1.2f);
-    drawHouse(1.0f, -0.6f, 1.2f);
-    drawHouse(2.0f, -0.6f, 1.0f);
+    { ProfileZone zone("drawStaticLayer(houses)"); drawStaticLayer(LAYER_HOUSES); }
 
-    drawButterflies();
-    drawFireflies();
-    drawRainAndSplashes();
-    drawSnow();
-    drawParticles();
-    drawForegroundRiver();
+    { ProfileZone zone("drawButterflies"); drawButterflies(); }
+    { ProfileZone zone("drawFireflies"); drawFireflies(); }
+    { ProfileZone zone("drawRainAndSplashes"); drawRainAndSplashes(); }
+    { ProfileZone zone("drawSnow"); drawSnow(); }
+    { ProfileZone zone("drawParticles"); drawParticles(); }
+    { ProfileZone zone("drawForegroundRiver"); drawForegroundRiver(); }
 
 
     if (currentWeather == SUNNY) {
-        drawElves();
+        { ProfileZone zone("drawElves"); drawElves(); }
+    }
+}
+
+// Lists every profiled scope in the top-left corner ('p' toggles it).
+void drawProfilerOverlay() {
+    if (!profilerOverlayVisible) return;
+
+    glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
+    glDisable(GL_LIGHTING);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluOrtho2D(0, windowWidth, windowHeight, 0);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+
+    lock_guard<mutex> guard(profileLock);
+    const int lineHeight = 15;
+    glColor4f(0.0f, 0.0f, 0.0f, 0.6f);
+    glRectf(5.0f, 5.0f, 580.0f, 30.0f + lineHeight * (profileStatCount + 1));
+
+    char line[128];
+    char vertices[24], drawCalls[24], stateChanges[24];
+    glColor4f(1.0f, 1.0f, 0.8f, 1.0f);
+    for (int i = -1; i < profileStatCount; ++i) {
+        if (i < 0) {
+            snprintf(line, sizeof(line), "%-28s %7s %7s %7s %5s %6s %6s", "scope", "cpu ms", "gpu ms", "verts", "draws", "states", "allocs");
+        } else {
+            const ProfileStat& s = profileStats[i];
+            snprintf(line, sizeof(line), "%*s%-*s %7.3f %7.3f %7s %5s %6s %6lld", s.depth * 2, "", 28 - s.depth * 2, s.name,
+                     s.avgCpuMs, s.avgGpuMs, glCountText(vertices, sizeof(vertices), s.lastVertices),
+                     glCountText(drawCalls, sizeof(drawCalls), s.lastDrawCalls),
+                     glCountText(stateChanges, sizeof(stateChanges), s.lastStateChanges), s.lastAllocations);
+        }
+        glRasterPos2f(10.0f, 20.0f + lineHeight * (i + 1));
+        for (const char* c = line; *c; ++c) glutBitmapCharacter(GLUT_BITMAP_8_BY_13, *c);
     }
+    const RenderQueueStats& q = renderQueueLast;
+    snprintf(line, sizeof(line), "render queue: %lld cmds, states %lld unsorted (est.) -> %lld, draws %lld unsorted (est.) -> %lld",
+             q.commands, q.stateChangesSubmitted, q.stateChangesIssued, q.drawCallsSubmitted, q.drawCallsIssued);
+    glRasterPos2f(10.0f, 20.0f + lineHeight * (profileStatCount + 1));
+    for (const char* c = line; *c; ++c) glutBitmapCharacter(GLUT_BITMAP_8_BY_13, *c);
+
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopAttrib();
+}
 
+void display() {
+    profileBeginFrame();
+    {
+        ProfileZone zone("renderScene");
+        renderScene();
+    }
+    drawProfilerOverlay();
+    profileEndFrame();
     glutSwapBuffers();
 }
 
-void keyboard(unsigned char key, int x, int y) {
+// Switches to the weather preset bound to `key` (r, s, w, m or b) and returns
+// its name. Shared by keyboard() and the benchmark scenarios, which switch
+// weather without printing. The simulation must not be running.
+const char* setWeather(unsigned char key) {
     switch (key) {
         case 'r': case 'R':
             currentWeather = RAINY;
-            printf("Weather: Rainy\n");
-            break;
+            rainCount = RAIN_COUNT;
+            return "Rainy";
         case 's': case 'S':
             currentWeather = SUNNY;
-            printf("Weather: Sunny\n");
-            break;
+            return "Sunny";
         case 'w': case 'W':
             currentWeather = SNOWY;
-            printf("Weather: Snowy\n");
+            snowCount = SNOW_COUNT;
+            return "Snowy";
+        case 'm': case 'M':
+            currentWeather = RAINY;
+            rainCount = MAX_RAIN;
+            return "Monsoon";
+        case 'b': case 'B':
+            currentWeather = SNOWY;
+            snowCount = MAX_SNOW;
+            return "Blizzard";
+    }
+    return NULL;
+}
+
+void keyboard(unsigned char key, int x, int y) {
+    finishSimulation();
+    switch (key) {
+        case 'r': case 'R': case 's': case 'S': case 'w': case 'W':
+        case 'm': case 'M': case 'b': case 'B':
+            printf("Weather: %s\n", setWeather(key));
+            break;
+        case 'p': case 'P':
+            profilerOverlayVisible = !profilerOverlayVisible;
+            break;
+        case 't': case 'T':
+            startTrace(TRACE_DEFAULT_FRAMES);
+            printf("Profiler: tracing the next %d frames\n", TRACE_DEFAULT_FRAMES);
+            break;
+        case ']':
+            setTimeScale(simTimeScale * 2.0f);
+            printf("Time scale: %gx\n", simTimeScale);
+            break;
+        case '[':
+            setTimeScale(simTimeScale * 0.5f);
+            printf("Time scale: %gx\n", simTimeScale);
+            break;
+        case 'f': case 'F':
+            fastForward(10.0);
+            printf("Fast-forwarded 10 s, day phase %.3f\n", dayNightPhase);
             break;
         case 27: // ESC key
             cleanup();
             exit(0);
             break;
     }
+    publishSnapshot();
     updateAudio();
 }
 void reshape(int w, int h) {
@@ -2840,6 +6386,11 @@ void reshape(int w, int h) {
     glLoadIdentity();
 
     if (h == 0) h = 1;
+    windowWidth = w;
+    windowHeight = h;
+
+    // The scene spans 5 x 3 world units; used to pick the point path for tiny circles.
+    pixelsPerUnit = 0.5f * (w / 5.0f + h / 3.0f);
 
     gluOrtho2D(-2.5f, 2.5f, -1.5f, 1.5f);
 
@@ -2857,30 +6408,48 @@ void initAudio() {
         return;
     }
 
+    // Channels 0..AUDIO_BED_COUNT-1 belong to the beds; reserving them keeps
+    // Mix_PlayChannel(-1, ...) from ever stealing one.
+    Mix_AllocateChannels(AUDIO_BED_COUNT + 8);
+    Mix_ReserveChannels(AUDIO_BED_COUNT);
 
-    riverSound = Mix_LoadMUS("E:/AIUB/AIUB/Semester - 8/Computer design/Final/New folder/river.mp3");
-    if (!riverSound) printf("Load Error: river.mp3 - %s\n", Mix_GetError());
-
-
-    winterSound = Mix_LoadMUS("E:/AIUB/AIUB/Semester - 8/Computer design/Final/New folder/winter.mp3");
-    if (!winterSound) printf("Load Error: winter.mp3 - %s\n", Mix_GetError());
-
-    thunderSound = Mix_LoadWAV("E:/AIUB/AIUB/Semester - 8/Computer design/Final/New folder/thunder.wav");
-    if (!thunderSound) printf("Load Error: thunder.wav - %s\n", Mix_GetError());
-
-    birdSound = Mix_LoadWAV("E:/AIUB/AIUB/Semester - 8/Computer design/Final/New folder/bird.mp3");
-    if (!birdSound) printf("Load Error: bird.mp3 - %s\n", Mix_GetError());
+    // Beds come from the memory-mapped asset pack, opened by main(); without
+    // one the ambience is silent but the synthesized rain still plays.
+    if (assetPack.file.base) {
+        for (int bed = 0; bed < AUDIO_BED_COUNT; bed++) {
+            audioBeds[bed] = loadAudioAsset(audioBedFiles[bed]);
+        }
+    }
 
-    rainSound = Mix_LoadWAV("E:/AIUB/AIUB/Semester - 8/Computer design/Final/New folder/rain.mp3");
-    if (!rainSound) printf("Load Error: rain.mp3 - %s\n", Mix_GetError());
+    // Rain is generated in the music hook; it plays silence until it rains.
+    int frequency, channels;
+    Uint16 format;
+    if (Mix_QuerySpec(&frequency, &format, &channels) && format == AUDIO_S16SYS && channels == 2) {
+        rainSynth.sse2 = weatherKernelPath != KERNEL_SCALAR;
+        rainSynth.gustStep = TWO_PI * 0.15f / frequency; // one gust every ~7 s
+        Mix_HookMusic(rainAudioCallback, NULL);
+        rainAudioHooked = true;
+    } else {
+        printf("Rain audio disabled: mixer is not 16-bit stereo\n");
+    }
+    audioReady = true;
 }
 
 void cleanup() {
-    if (rainSound) Mix_FreeChunk(rainSound);
-    if (birdSound) Mix_FreeChunk(birdSound);
-    if (thunderSound) Mix_FreeChunk(thunderSound);
-    if (riverSound) Mix_FreeMusic(riverSound);
-    if (winterSound) Mix_FreeMusic(winterSound);
+    shutdownJobSystem();
+    if (traceFramesLeft > 0) writeChromeTrace(tracePath);
+    if (audioReady) {
+        rainAudioHooked = false;
+        Mix_HookMusic(NULL, NULL);
+        Mix_HaltChannel(-1);
+        for (int bed = 0; bed < AUDIO_BED_COUNT; bed++) {
+            if (audioBeds[bed]) Mix_FreeChunk(audioBeds[bed]);
+            audioBeds[bed] = NULL;
+        }
+        audioReady = false;
+    }
+    closeAssetPack(); // after the chunks that may point into it
+    unmapFile(sceneLayoutFile);
 
     Mix_CloseAudio();
     Mix_Quit();
@@ -2889,13 +6458,366 @@ void cleanup() {
 }
 
 
+// --- Headless Rendering ---
+// `--headless N` runs N simulation steps without a window, drawing each one
+// into an offscreen EGL pbuffer. The last frame's pixels are hashed so a CI
+// job can compare runs with the same --seed; `--dump-every K` also writes
+// every Kth frame as a PPM image. `--profile` prints per-scope timings at the
+// end and `--trace FILE [FRAMES]` records the first FRAMES frames (300 by
+// default) as a Chrome trace.
+
+int headlessTicks = 0;          // 0 = normal windowed run
+int headlessDumpEvery = 0;
+const char* headlessDumpPrefix = "frame";
+
+#if HEADLESS_EGL
+EGLDisplay headlessDisplay = EGL_NO_DISPLAY;
+EGLSurface headlessSurface = EGL_NO_SURFACE;
+EGLContext headlessContext = EGL_NO_CONTEXT;
+#endif
+
+// Releases whatever createHeadlessContext() managed to set up.
+void destroyHeadlessContext() {
+#if HEADLESS_EGL
+    if (headlessDisplay == EGL_NO_DISPLAY) return;
+    eglMakeCurrent(headlessDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (headlessContext != EGL_NO_CONTEXT) eglDestroyContext(headlessDisplay, headlessContext);
+    if (headlessSurface != EGL_NO_SURFACE) eglDestroySurface(headlessDisplay, headlessSurface);
+    eglTerminate(headlessDisplay);
+    headlessDisplay = EGL_NO_DISPLAY;
+    headlessSurface = EGL_NO_SURFACE;
+    headlessContext = EGL_NO_CONTEXT;
+#endif
+}
+
+bool createHeadlessContext(int width, int height) {
+#if HEADLESS_EGL
+    EGLDisplay dpy = EGL_NO_DISPLAY;
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay) dpy = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (dpy == EGL_NO_DISPLAY) dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, NULL, NULL)) {
+        printf("Headless: no EGL display\n");
+        return false;
+    }
+    headlessDisplay = dpy;
+
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglChooseConfig(dpy, configAttribs, &config, 1, &configCount) || configCount == 0) {
+        printf("Headless: no pbuffer-capable EGL config\n");
+        destroyHeadlessContext();
+        return false;
+    }
+
+    const EGLint surfaceAttribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+    headlessSurface = eglCreatePbufferSurface(dpy, config, surfaceAttribs);
+    eglBindAPI(EGL_OPENGL_API);
+    headlessContext = eglCreateContext(dpy, config, EGL_NO_CONTEXT, NULL);
+    if (headlessSurface == EGL_NO_SURFACE || headlessContext == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(dpy, headlessSurface, headlessSurface, headlessContext)) {
+        printf("Headless: could not create EGL context (0x%x)\n", eglGetError());
+        destroyHeadlessContext();
+        return false;
+    }
+    printf("Headless: %s\n", (const char*)glGetString(GL_RENDERER));
+    return true;
+#else
+    (void)width; (void)height;
+    printf("Headless: not built in (compile with -DHEADLESS_EGL=1)\n");
+    return false;
+#endif
+}
+
+// Reads the framebuffer back top row first as tightly packed RGB.
+void readFrame(vector<unsigned char>& rgb, int width, int height) {
+    vector<unsigned char> rows(width * height * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, rows.data());
+    rgb.resize(rows.size());
+    for (int y = 0; y < height; ++y) {
+        memcpy(&rgb[y * width * 3], &rows[(height - 1 - y) * width * 3], width * 3);
+    }
+}
+
+bool writePPM(const char* path, const vector<unsigned char>& rgb, int width, int height) {
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    fwrite(rgb.data(), 1, rgb.size(), file);
+    fclose(file);
+    return true;
+}
+
+// 64-bit FNV-1a.
+uint64_t frameChecksum(const vector<unsigned char>& rgb) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : rgb) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// --time-of-day and --fast-forward, applied once the scene is set up (used
+// to pre-warm the scene or to start straight at night).
+float startupTimeOfDay = -1.0f;    // < 0 = the scene's default
+double startupFastForward = 0.0;   // seconds
+
+void applyStartupClock() {
+    if (startupTimeOfDay >= 0.0f) setTimeOfDay(startupTimeOfDay);
+    if (startupFastForward > 0.0) fastForward(startupFastForward);
+    publishSnapshot();
+}
+
+int runHeadless() {
+    if (!createHeadlessContext(WINDOW_WIDTH, WINDOW_HEIGHT)) return 1;
+    reshape(WINDOW_WIDTH, WINDOW_HEIGHT);
+#if HEADLESS_EGL
+    initProfiler([](const char* name) { return (void*)eglGetProcAddress(name); });
+    initShaderEffects([](const char* name) { return (void*)eglGetProcAddress(name); });
+    initSpriteAtlas([](const char* name) { return (void*)eglGetProcAddress(name); });
+#endif
+    initSceneElements();
+    applyStartupClock();
+
+    vector<unsigned char> rgb;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int tick = 1; tick <= headlessTicks; ++tick) {
+        updateScene();
+        publishSnapshot();
+        profileBeginFrame();
+        {
+            ProfileZone zone("renderScene");
+            renderScene();
+        }
+        profileEndFrame();
+
+        if (headlessDumpEvery > 0 && tick % headlessDumpEvery == 0) {
+            char path[512];
+            snprintf(path, sizeof(path), "%s_%05d.ppm", headlessDumpPrefix, tick);
+            readFrame(rgb, WINDOW_WIDTH, WINDOW_HEIGHT);
+            if (!writePPM(path, rgb, WINDOW_WIDTH, WINDOW_HEIGHT)) printf("Headless: could not write %s\n", path);
+        }
+    }
+    glFinish();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    readFrame(rgb, WINDOW_WIDTH, WINDOW_HEIGHT);
+    printf("Headless: %d ticks in %.3f s (%.3f ms/tick)\n", headlessTicks, seconds,
+           headlessTicks > 0 ? seconds * 1000.0 / headlessTicks : 0.0);
+    printf("Frame checksum: %016llx\n", (unsigned long long)frameChecksum(rgb));
+    if (traceFramesLeft > 0) writeChromeTrace(tracePath);
+    if (profileReport) printProfileSummary();
+
+    shutdownJobSystem();
+    destroyHeadlessContext();
+    return 0;
+}
+
+// --- Benchmark ---
+// `--benchmark N` replays each scripted scenario from the same seed: reset
+// the scene, apply the scenario's setup, run BENCHMARK_WARMUP_TICKS unmeasured
+// steps, then time N frames of one simulation step plus a full draw
+// (finished with glFinish). `--scenario NAME` runs just one of them.
+// `--max-allocs-per-frame X` turns the run into a check: it exits non-zero if
+// any scenario's measured frames average more than X heap allocations.
+
+struct BenchmarkScenario {
+    const char* name;
+    void (*setup)();
+    void (*input)(int tick);   // scripted weather switches, may be NULL
+};
+
+const int BENCHMARK_WARMUP_TICKS = 120;
+int benchmarkFrames = 0;        // 0 = no benchmark
+const char* benchmarkScenario = NULL;
+double benchmarkMaxAllocsPerFrame = -1.0; // < 0 = no allocation check
+
+BenchmarkScenario benchmarkScenarios[] = {
+    { "sunny-noon",      [] { dayNightPhase = 0.25f; }, NULL },
+    { "night-fireflies", [] { dayNightPhase = 0.75f; }, NULL },
+    { "heavy-rain",      [] { dayNightPhase = 0.25f; setWeather('m'); }, NULL },
+    { "full-snow",       [] { dayNightPhase = 0.25f; setWeather('w'); snowCoverage = 1.0f; riverFreezeAmount = 1.0f; }, NULL },
+    { "weather-toggle",  [] { dayNightPhase = 0.25f; },
+                         [](int tick) { if (tick % 30 == 0) setWeather("rswmb"[(tick / 30) % 5]); } },
+};
+const int BENCHMARK_SCENARIO_COUNT = sizeof(benchmarkScenarios) / sizeof(benchmarkScenarios[0]);
+
+void benchmarkTick(const BenchmarkScenario& scenario, int tick) {
+    if (scenario.input) scenario.input(tick);
+    updateScene();
+    publishSnapshot();
+    profileBeginFrame();
+    {
+        ProfileZone zone("renderScene");
+        renderScene();
+    }
+    profileEndFrame();
+    glFinish();
+}
+
+double percentile(const vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0.0;
+    size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+bool isBenchmarkScenario(const char* name) {
+    for (const BenchmarkScenario& scenario : benchmarkScenarios) {
+        if (strcmp(name, scenario.name) == 0) return true;
+    }
+    return false;
+}
+
+int runBenchmark() {
+    if (benchmarkScenario && !isBenchmarkScenario(benchmarkScenario)) {
+        printf("Benchmark: unknown scenario '%s'\n", benchmarkScenario);
+        printf("Usage: --benchmark FRAMES [--scenario NAME], where NAME is one of:");
+        for (const BenchmarkScenario& scenario : benchmarkScenarios) printf(" %s", scenario.name);
+        printf("\n");
+        return 2;
+    }
+    if (!createHeadlessContext(WINDOW_WIDTH, WINDOW_HEIGHT)) return 1;
+    reshape(WINDOW_WIDTH, WINDOW_HEIGHT);
+#if HEADLESS_EGL
+    initProfiler([](const char* name) { return (void*)eglGetProcAddress(name); });
+    initShaderEffects([](const char* name) { return (void*)eglGetProcAddress(name); });
+    initSpriteAtlas([](const char* name) { return (void*)eglGetProcAddress(name); });
+#endif
+    if (!sceneSeedFixed) {
+        sceneSeed = 1;
+        sceneSeedFixed = true;
+    }
+    initSceneElements();
+
+    printf("%-16s %7s %8s %8s %8s %8s %10s %8s %9s\n", "scenario", "frames", "mean ms", "p50 ms", "p99 ms", "max ms", "allocs", "allocs/f", "arena KB");
+    vector<double> frameMs(benchmarkFrames);
+    int overAllocationBudget = 0;
+    for (const BenchmarkScenario& scenario : benchmarkScenarios) {
+        if (benchmarkScenario && strcmp(benchmarkScenario, scenario.name) != 0) continue;
+
+        resetScene();
+        scenario.setup();
+        int tick = 0;
+        for (int i = 0; i < BENCHMARK_WARMUP_TICKS; ++i) benchmarkTick(scenario, tick++);
+
+        long long allocationsBefore = allocationCount.load();
+        double totalMs = 0.0;
+        for (int i = 0; i < benchmarkFrames; ++i) {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            benchmarkTick(scenario, tick++);
+            frameMs[i] = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            totalMs += frameMs[i];
+        }
+        long long allocations = allocationCount.load() - allocationsBefore;
+
+        vector<double> sorted = frameMs;
+        sort(sorted.begin(), sorted.end());
+        printf("%-16s %7d %8.3f %8.3f %8.3f %8.3f %10lld %8.2f %9zu\n", scenario.name, benchmarkFrames,
+               totalMs / benchmarkFrames, percentile(sorted, 0.5), percentile(sorted, 0.99), sorted.back(),
+               allocations, (double)allocations / benchmarkFrames, frameArena.peakBytes / 1024);
+        if (benchmarkMaxAllocsPerFrame >= 0.0 && (double)allocations / benchmarkFrames > benchmarkMaxAllocsPerFrame) {
+            printf("%-16s exceeds %.2f allocs/frame\n", scenario.name, benchmarkMaxAllocsPerFrame);
+            ++overAllocationBudget;
+        }
+    }
+    if (traceFramesLeft > 0) writeChromeTrace(tracePath);
+    if (profileReport) printProfileSummary();
+
+    shutdownJobSystem();
+    destroyHeadlessContext();
+    return overAllocationBudget > 0 ? 1 : 0;
+}
+
+
 int main(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            sceneSeed = strtoull(argv[++i], nullptr, 10);
+            sceneSeedFixed = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            jobThreadCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc) {
+            headlessTicks = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--dump-every") == 0 && i + 1 < argc) {
+            headlessDumpEvery = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--dump-prefix") == 0 && i + 1 < argc) {
+            headlessDumpPrefix = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            tracePath = argv[++i];
+            traceFramesLeft = TRACE_DEFAULT_FRAMES;
+            if (i + 1 < argc && argv[i + 1][0] >= '0' && argv[i + 1][0] <= '9') {
+                traceFramesLeft = atoi(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            profileReport = true;
+        } else if (strcmp(argv[i], "--no-shaders") == 0) {
+            shaderEffectsDisabled = true;
+        } else if (strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc) {
+            benchmarkFrames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scenario") == 0 && i + 1 < argc) {
+            benchmarkScenario = argv[++i];
+        } else if (strcmp(argv[i], "--time-of-day") == 0 && i + 1 < argc) {
+            startupTimeOfDay = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--fast-forward") == 0 && i + 1 < argc) {
+            startupFastForward = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--time-scale") == 0 && i + 1 < argc) {
+            setTimeScale((float)atof(argv[++i]));
+        } else if (strcmp(argv[i], "--max-allocs-per-frame") == 0 && i + 1 < argc) {
+            benchmarkMaxAllocsPerFrame = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--assets") == 0 && i + 1 < argc) {
+            assetPackPath = argv[++i];
+            assetPackRequested = true;
+        } else if (strcmp(argv[i], "--pack-assets") == 0 && i + 2 < argc) {
+            packAssetsDir = argv[++i];
+            packAssetsOut = argv[++i];
+        } else if (strcmp(argv[i], "--pcm") == 0) {
+            packAssetsPcm = true;
+        } else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc) {
+            sceneLayoutPath = argv[++i];
+        } else if (strcmp(argv[i], "--export-scene") == 0 && i + 1 < argc) {
+            exportScenePath = argv[++i];
+        }
+    }
+
+    if (packAssetsDir) {
+        return runPackAssets(packAssetsDir, packAssetsOut, packAssetsPcm);
+    }
+    if (exportScenePath) {
+        return runExportScene(exportScenePath);
+    }
+
+    // Every entry point reads the same pack. The default one is optional, so
+    // its absence is not reported; a pack named with --assets must open.
+    if (assetPackRequested || fileExists(assetPackPath)) {
+        openAssetPack(assetPackPath);
+    }
+
+    if (benchmarkFrames > 0) {
+        return runBenchmark();
+    }
+    if (headlessTicks > 0) {
+        return runHeadless();
+    }
+
     glutInit(&argc, argv);
-    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB);
-    glutInitWindowSize(1920, 1080);
+    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_ALPHA); // the sprite atlas bakes alpha
+    glutInitWindowSize(WINDOW_WIDTH, WINDOW_HEIGHT);
     glutCreateWindow("Elven Village");
 
+    initProfiler([](const char* name) { return (void*)glutGetProcAddress(name); });
+    initShaderEffects([](const char* name) { return (void*)glutGetProcAddress(name); });
+    initSpriteAtlas([](const char* name) { return (void*)glutGetProcAddress(name); });
     initSceneElements();
+    applyStartupClock();
     initAudio();
 
     atexit(cleanup);
@@ -2903,7 +6825,7 @@ int main(int argc, char** argv) {
     glutDisplayFunc(display);
     glutReshapeFunc(reshape);
     glutKeyboardFunc(keyboard);
-    glutTimerFunc(16, updateScene, 0);
+    glutIdleFunc(frameLoop);
 
     updateAudio();
 